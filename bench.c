@@ -0,0 +1,410 @@
+//-------------------------------------------------------------------------
+//Benchmarks for the word tree on reproducible synthetic corpora.
+//
+//  gcc -std=gnu17 -O2 -pthread -o bench bench.c tree.c
+//  ./bench [max_tokens]
+//
+//Each corpus (uniform, zipf, sorted, reverse, prefix) is generated from a
+//fixed seed at 10K, 100K and 1M tokens, plus 10M and 50M when max_tokens
+//allows (default 1000000). For every tree mode it times file_input,
+//tree_add from memory, lookups of up to 100K present and absent words
+//(one at a time and batched), an in-order print to /dev/null and
+//tree_clear, and writes one tab-separated line per measurement to
+//bench_output.txt.
+//Plain BSTs are skipped on sorted input past 2000 distinct words, where
+//they degenerate into lists and the run would be quadratic.
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "tree.h"
+
+#define BENCH_SEED 0x5eed5eedULL
+#define BENCH_OUTPUT "bench_output.txt"
+#define PLAIN_SORTED_MAX 2000
+#define BENCH_PROBES 100000
+
+//-------------------------------------------------------------------------
+enum corpus_kind { CORPUS_UNIFORM, CORPUS_ZIPF, CORPUS_SORTED, CORPUS_REVERSE, CORPUS_PREFIX };
+
+static const char* corpus_names[] = {"uniform", "zipf", "sorted", "reverse", "prefix"};
+
+//-------------------------------------------------------------------------
+enum bench_mode { BENCH_PLAIN, BENCH_AVL, BENCH_ARENA, BENCH_HASH, BENCH_BTREE };
+
+static const char* mode_names[] = {"plain", "avl", "avl+arena", "hash+arena", "btree"};
+
+static const int tree_modes[] = {TREE_PLAIN, TREE_AVL, TREE_AVL | TREE_ARENA,
+                                 TREE_HASH | TREE_ARENA, 0};
+
+//-------------------------------------------------------------------------
+//generated tokens: words separated by spaces, a newline every 16 words
+typedef struct corpus corpus;
+struct corpus {
+  int kind;
+  size_t tokens;
+  size_t vocab;
+  char* text;
+  size_t len;
+};
+
+//-------------------------------------------------------------------------
+static uint64_t splitmix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//-------------------------------------------------------------------------
+static double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-------------------------------------------------------------------------
+//word number i of the vocabulary: 3 to 10 letters derived from a hash of
+//i, so rank and alphabetical order are unrelated
+static size_t vocab_word(char* out, uint64_t i) {
+  uint64_t state = BENCH_SEED ^ (i * 0x2545f4914f6cdd1dULL);
+  uint64_t h = splitmix64(&state);
+  size_t len = 3 + h % 8;
+
+  h = splitmix64(&state);
+  for (size_t k = 0; k < len; ++k) {
+    out[k] = 'a' + h % 26;
+    h /= 26;
+  }
+  return len;
+}
+
+//-------------------------------------------------------------------------
+//long shared stems in front of an ordinary word, so every comparison has
+//to get past 20-30 equal bytes
+static const char* prefix_stems[] = {
+  "internationalization", "counterrevolutionary", "electroencephalograph",
+  "incomprehensibilities", "uncharacteristically", "telecommunications",
+  "interdisciplinarities", "pseudopseudohypoparathyroid",
+};
+
+//-------------------------------------------------------------------------
+static size_t corpus_word(char* out, int kind, uint64_t i) {
+  if (kind != CORPUS_PREFIX) { return vocab_word(out, i); }
+
+  const char* stem = prefix_stems[i % (sizeof(prefix_stems) / sizeof(prefix_stems[0]))];
+  size_t n = strlen(stem);
+  memcpy(out, stem, n);
+  return n + vocab_word(out + n, i);
+}
+
+//-------------------------------------------------------------------------
+static int bench_strcmp(const void* a, const void* b) {
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+//-------------------------------------------------------------------------
+//vocabulary in ascending order, for the sorted and reverse corpora
+static char** vocab_sorted(size_t vocab, char** storage) {
+  char** words = (char**)malloc(vocab * sizeof(char*));
+  char* s = *storage = (char*)malloc(vocab * 11);
+
+  for (size_t i = 0; i < vocab; ++i) {
+    words[i] = s;
+    s += vocab_word(s, i);
+    *s++ = '\0';
+  }
+  qsort(words, vocab, sizeof(char*), bench_strcmp);
+  return words;
+}
+
+//-------------------------------------------------------------------------
+//inverse CDF table for a Zipf(1) draw over vocab ranks
+static double* zipf_table(size_t vocab) {
+  double* cdf = (double*)malloc(vocab * sizeof(double));
+  double sum = 0;
+
+  for (size_t i = 0; i < vocab; ++i) { cdf[i] = sum += 1.0 / (i + 1); }
+  for (size_t i = 0; i < vocab; ++i) { cdf[i] /= sum; }
+  return cdf;
+}
+
+//-------------------------------------------------------------------------
+static size_t zipf_draw(const double* cdf, size_t vocab, uint64_t* state) {
+  double u = (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+  size_t lo = 0, hi = vocab - 1;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < u) { lo = mid + 1; } else { hi = mid; }
+  }
+  return lo;
+}
+
+//-------------------------------------------------------------------------
+static void corpus_generate(corpus* c, int kind, size_t tokens) {
+  size_t vocab = tokens / 10;
+  if (vocab < 1000) { vocab = 1000; }
+  if (vocab > 2000000) { vocab = 2000000; }
+
+  c->kind = kind;
+  c->tokens = tokens;
+  c->vocab = vocab;
+  c->text = (char*)malloc(tokens * 42 + 1);
+  c->len = 0;
+
+  uint64_t state = BENCH_SEED + kind;
+  double* cdf = kind == CORPUS_ZIPF ? zipf_table(vocab) : NULL;
+  char* storage = NULL;
+  char** sorted = kind == CORPUS_SORTED || kind == CORPUS_REVERSE ? vocab_sorted(vocab, &storage) : NULL;
+
+  for (size_t i = 0; i < tokens; ++i) {
+    char* out = c->text + c->len;
+    size_t rank = i * vocab / tokens;   //sorted runs: each word repeated in place
+
+    switch (kind) {
+    case CORPUS_ZIPF:
+      c->len += vocab_word(out, zipf_draw(cdf, vocab, &state));
+      break;
+    case CORPUS_SORTED:
+    case CORPUS_REVERSE: {
+      const char* w = sorted[kind == CORPUS_SORTED ? rank : vocab - 1 - rank];
+      size_t n = strlen(w);
+      memcpy(out, w, n);
+      c->len += n;
+      break;
+    }
+    default:
+      c->len += corpus_word(out, kind, splitmix64(&state) % vocab);
+      break;
+    }
+    c->text[c->len++] = i % 16 == 15 ? '\n' : ' ';
+  }
+  c->text[c->len] = '\0';
+
+  free(cdf);
+  free(sorted);
+  free(storage);
+}
+
+//-------------------------------------------------------------------------
+static void corpus_save(corpus* c, const char* filename) {
+  FILE* f = fopen(filename, "wb");
+  if (f == NULL || fwrite(c->text, 1, c->len, f) != c->len || fclose(f) != 0) {
+    fprintf(stderr, "Error writing file: %s\n", filename);
+    exit(1);
+  }
+}
+
+//-------------------------------------------------------------------------
+//splits the text in place into NUL-terminated tokens for tree_add
+static const char** corpus_tokens(corpus* c) {
+  const char** v = (const char**)malloc(c->tokens * sizeof(const char*));
+  size_t n = 0;
+  char* p = c->text;
+  char* end = c->text + c->len;
+
+  while (p < end) {
+    v[n++] = p;
+    while (*p != ' ' && *p != '\n') { ++p; }
+    *p++ = '\0';
+  }
+  return v;
+}
+
+//-------------------------------------------------------------------------
+//ns_per_op is per token, or per probe for the lookup rows
+static void bench_report(FILE* out, corpus* c, size_t distinct, int mode, const char* phase,
+                         double seconds, size_t ops) {
+  fprintf(out, "%s\t%zu\t%zu\t%s\t%s\t%.6f\t%.1f\n", corpus_names[c->kind], c->tokens, distinct,
+          mode_names[mode], phase, seconds, seconds * 1e9 / ops);
+  fflush(out);
+}
+
+//-------------------------------------------------------------------------
+//lookup keys: words drawn from the corpus, and corpus-like words with a
+//digit appended, which the letters-only corpora never contain
+typedef struct probes probes;
+struct probes {
+  const char** hit;
+  const char** miss;
+  size_t n;
+  char* storage;
+};
+
+//-------------------------------------------------------------------------
+static void probes_create(probes* p, corpus* c, const char** tokens) {
+  p->n = c->tokens < BENCH_PROBES ? c->tokens : BENCH_PROBES;
+  p->hit = (const char**)malloc(p->n * sizeof(const char*));
+  p->miss = (const char**)malloc(p->n * sizeof(const char*));
+  p->storage = (char*)malloc(p->n * 42);
+
+  uint64_t state = BENCH_SEED ^ 0x9e0be5ULL;
+  char* s = p->storage;
+  for (size_t i = 0; i < p->n; ++i) {
+    p->hit[i] = tokens[splitmix64(&state) % c->tokens];
+    p->miss[i] = s;
+    s += corpus_word(s, c->kind, splitmix64(&state) % c->vocab);
+    *s++ = '0';
+    *s++ = '\0';
+  }
+}
+
+//-------------------------------------------------------------------------
+static void probes_delete(probes* p) {
+  free(p->hit);
+  free(p->miss);
+  free(p->storage);
+}
+
+//-------------------------------------------------------------------------
+//single tree_find and batched tree_find_many, for present and absent words
+static void bench_lookup(FILE* out, corpus* c, tree* t, probes* p, int mode) {
+  tnode** found = (tnode**)malloc(p->n * sizeof(tnode*));
+  const char** keys[] = {p->hit, p->miss};
+  const char* single[] = {"find_hit", "find_miss"};
+  const char* batched[] = {"find_many_hit", "find_many_miss"};
+  size_t sink = 0;
+
+  for (int k = 0; k < 2; ++k) {
+    double t0 = bench_now();
+    for (size_t i = 0; i < p->n; ++i) { sink += tree_find(t, keys[k][i]) != NULL; }
+    double t1 = bench_now();
+    tree_find_many(t, keys[k], p->n, found);
+    double t2 = bench_now();
+    for (size_t i = 0; i < p->n; ++i) { sink += found[i] != NULL; }
+
+    bench_report(out, c, tree_size(t), mode, single[k], t1 - t0, p->n);
+    bench_report(out, c, tree_size(t), mode, batched[k], t2 - t1, p->n);
+  }
+  if (sink != 2 * p->n) { fprintf(stderr, "%s: lookups found %zu of %zu hits\n", mode_names[mode], sink, 2 * p->n); }
+  free(found);
+}
+
+//-------------------------------------------------------------------------
+//the clear between file_input and tree_add is left out of both spans;
+//teardown is timed once, on its own row
+static void bench_tree(FILE* out, corpus* c, const char* filename, const char** tokens, probes* p,
+                       int mode, int devnull) {
+  double t0 = bench_now();
+  tree* t = tree_create_mode(tree_modes[mode]);
+  file_input(t, filename);
+  double t1 = bench_now();
+  tree_clear(t);
+  double t2 = bench_now();
+  for (size_t i = 0; i < c->tokens; ++i) { tree_add(t, tokens[i]); }
+  double t3 = bench_now();
+  size_t distinct = tree_size(t);
+  bench_report(out, c, distinct, mode, "file_input", t1 - t0, c->tokens);
+  bench_report(out, c, distinct, mode, "tree_add", t3 - t2, c->tokens);
+
+  bench_lookup(out, c, t, p, mode);
+
+  double t4 = bench_now();
+  tree_writer w;
+  tree_writer_open(&w, devnull, TREE_FMT_DEBUG);
+  tree_write(t, TREE_INORDER, &w);
+  tree_writer_close(&w);
+  double t5 = bench_now();
+
+  tree_clear(t);
+  double t6 = bench_now();
+  free(t);
+
+  bench_report(out, c, distinct, mode, "print", t5 - t4, c->tokens);
+  bench_report(out, c, distinct, mode, "clear", t6 - t5, c->tokens);
+}
+
+//-------------------------------------------------------------------------
+//the B-tree has its own API: file_input_btree stands in for file_input and
+//btree_count for tree_find; there is no batched lookup
+static void bench_btree(FILE* out, corpus* c, const char* filename, const char** tokens, probes* p,
+                        int devnull) {
+  double t0 = bench_now();
+  btree* t = btree_create();
+  file_input_btree(t, filename);
+  double t1 = bench_now();
+  btree_clear(t);
+  double t2 = bench_now();
+  for (size_t i = 0; i < c->tokens; ++i) { btree_add(t, tokens[i]); }
+  double t3 = bench_now();
+
+  size_t sink = 0;
+  for (size_t i = 0; i < p->n; ++i) { sink += btree_count(t, p->hit[i]) > 0; }
+  double t4 = bench_now();
+  for (size_t i = 0; i < p->n; ++i) { sink += btree_count(t, p->miss[i]) > 0; }
+  double t5 = bench_now();
+  if (sink != p->n) { fprintf(stderr, "btree: lookups found %zu of %zu hits\n", sink, p->n); }
+
+  tree_writer w;
+  tree_writer_open(&w, devnull, TREE_FMT_DEBUG);
+  btree_write(t, &w);
+  tree_writer_close(&w);
+  double t6 = bench_now();
+
+  size_t distinct = btree_size(t);
+  btree_clear(t);
+  double t7 = bench_now();
+  free(t);
+
+  bench_report(out, c, distinct, BENCH_BTREE, "file_input", t1 - t0, c->tokens);
+  bench_report(out, c, distinct, BENCH_BTREE, "tree_add", t3 - t2, c->tokens);
+  bench_report(out, c, distinct, BENCH_BTREE, "find_hit", t4 - t3, p->n);
+  bench_report(out, c, distinct, BENCH_BTREE, "find_miss", t5 - t4, p->n);
+  bench_report(out, c, distinct, BENCH_BTREE, "print", t6 - t5, c->tokens);
+  bench_report(out, c, distinct, BENCH_BTREE, "clear", t7 - t6, c->tokens);
+}
+
+//-------------------------------------------------------------------------
+int main(int argc, const char* argv[]) {
+  size_t sizes[] = {10000, 100000, 1000000, 10000000, 50000000};
+  size_t max_tokens = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+
+  FILE* out = fopen(BENCH_OUTPUT, "w");
+  int devnull = open("/dev/null", O_WRONLY);
+  if (out == NULL || devnull < 0) {
+    fprintf(stderr, "Error opening file: %s\n", out == NULL ? BENCH_OUTPUT : "/dev/null");
+    exit(1);
+  }
+  char filename[] = "/tmp/bench_corpus_XXXXXX";
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    fprintf(stderr, "Error creating corpus file\n");
+    exit(1);
+  }
+  close(fd);
+
+  fprintf(out, "corpus\ttokens\tdistinct\tmode\tphase\tseconds\tns_per_op\n");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= max_tokens; ++s) {
+    for (int kind = CORPUS_UNIFORM; kind <= CORPUS_PREFIX; ++kind) {
+      corpus c;
+      corpus_generate(&c, kind, sizes[s]);
+      corpus_save(&c, filename);
+      const char** tokens = corpus_tokens(&c);
+      probes p;
+      probes_create(&p, &c, tokens);
+      bool ordered = kind == CORPUS_SORTED || kind == CORPUS_REVERSE;
+      fprintf(stderr, "%s %zu\n", corpus_names[kind], sizes[s]);
+
+      for (int mode = BENCH_PLAIN; mode <= BENCH_HASH; ++mode) {
+        if (mode == BENCH_PLAIN && ordered && c.vocab > PLAIN_SORTED_MAX) { continue; }
+        bench_tree(out, &c, filename, tokens, &p, mode, devnull);
+      }
+      bench_btree(out, &c, filename, tokens, &p, devnull);
+
+      probes_delete(&p);
+      free(tokens);
+      free(c.text);
+    }
+  }
+
+  remove(filename);
+  close(devnull);
+  fclose(out);
+  return 0;
+}
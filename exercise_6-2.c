@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "timing.h"
 
 #define COMP_LIMIT 6
 
@@ -16,13 +17,54 @@ struct tnode {
   tnode* right;
 };
 
+//-------------------------------------------------------------------------
+//compressed trie node: the edge label leading here, shared by every word
+//below; children are kept sorted by the first byte of their labels
+typedef struct rnode rnode;
+struct rnode {
+  char* label;
+  size_t len;
+  int count;         //> 0 when a word ends here
+  rnode* child;
+  rnode* next;
+};
+
+//-------------------------------------------------------------------------
+enum tree_mode {
+  TREE_PLAIN = 0,    //binary search tree of tnodes
+  TREE_TRIE  = 1,    //compressed radix trie of rnodes
+};
+
 //-------------------------------------------------------------------------
 typedef struct tree tree;
 struct tree {
   tnode* root;
   size_t size;
+  int mode;
+  rnode* trie;       //TREE_TRIE only, a sentinel with an empty label
 };
 
+//-------------------------------------------------------------------------
+enum tree_order { TREE_INORDER, TREE_PREORDER, TREE_POSTORDER };
+
+#define TREE_ITER_SMALL 64
+
+//-------------------------------------------------------------------------
+typedef struct tree_iter tree_iter;
+struct tree_iter {
+  tnode** stack;
+  size_t top;
+  size_t cap;
+  int order;
+  tnode* cur;
+  tnode* last;       //last node returned, for postorder
+  tree* t;
+  tnode* small[TREE_ITER_SMALL];
+};
+
+//-------------------------------------------------------------------------
+typedef void (*tree_visit)(tnode* p, void* arg);
+
 //-------------------------------------------------------------------------
 tnode* tnode_create(const char* word) {
   tnode* p = (tnode*)malloc(sizeof(tnode));
@@ -40,13 +82,18 @@ void tnode_delete(tnode* t) {
 }
 
 //-------------------------------------------------------------------------
-tree* tree_create() {
+tree* tree_create_mode(int mode) {
   tree* p = (tree*)malloc(sizeof(tree));
   p->root = NULL;
   p->size = 0;
+  p->mode = mode;
+  p->trie = NULL;
   return p;
 }
 
+//-------------------------------------------------------------------------
+tree* tree_create() { return tree_create_mode(TREE_PLAIN); }
+
 //-------------------------------------------------------------------------
 static void tree_deletenodes(tree* t, tnode* p) {
   if ( p == NULL) { return; }
@@ -58,7 +105,40 @@ static void tree_deletenodes(tree* t, tnode* p) {
 }
 
 //-------------------------------------------------------------------------
-void tree_delete(tree* t) { tree_deletenodes(t, t->root); }
+static rnode* rnode_create(const char* label, size_t len, int count) {
+  rnode* p = (rnode*)malloc(sizeof(rnode));
+  p->label = (char*)malloc(len + 1);
+  memcpy(p->label, label, len);
+  p->label[len] = '\0';
+  p->len = len;
+  p->count = count;
+  p->child = NULL;
+  p->next = NULL;
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//recursion only follows children, so its depth is bounded by word length
+static void rnode_delete(rnode* p) {
+  while (p != NULL) {
+    rnode* q = p->next;
+    rnode_delete(p->child);
+    free(p->label);
+    free(p);
+    p = q;
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_delete(tree* t) {
+  if (t->mode == TREE_TRIE) {
+    rnode_delete(t->trie);
+    t->trie = NULL;
+    t->size = 0;
+    return;
+  }
+  tree_deletenodes(t, t->root);
+}
 
 //-------------------------------------------------------------------------
 bool tree_empty(tree* t) { return t->size == 0; }
@@ -66,6 +146,108 @@ bool tree_empty(tree* t) { return t->size == 0; }
 //-------------------------------------------------------------------------
 size_t tree_size(tree* t) { return t->size; }
 
+//-------------------------------------------------------------------------
+//strcmp of the word view w[0..len) against the NUL-terminated s; never
+//reads past the end of s, even if the view holds a NUL
+static int wordcmp(const char* w, size_t len, const char* s) {
+  size_t n = strnlen(s, len);
+  int compare = memcmp(w, s, n);
+  if (compare != 0) { return compare; }
+  if (n < len) { return 1; }
+  return s[len] == '\0' ? 0 : -1;
+}
+
+//-------------------------------------------------------------------------
+static void tree_iter_push(tree_iter* it, tnode* p) {
+  if (it->top == it->cap) {
+    size_t cap = it->cap * 2;
+    tnode** stack = (tnode**)malloc(cap * sizeof(tnode*));
+    memcpy(stack, it->stack, it->top * sizeof(tnode*));
+    if (it->stack != it->small) { free(it->stack); }
+    it->stack = stack;
+    it->cap = cap;
+  }
+  it->stack[it->top++] = p;
+}
+
+//-------------------------------------------------------------------------
+void tree_iter_begin(tree_iter* it, tree* t, int order) {
+  it->stack = it->small;
+  it->top = 0;
+  it->cap = TREE_ITER_SMALL;
+  it->order = order;
+  it->cur = t->root;
+  it->last = NULL;
+  it->t = t;
+
+  if (order == TREE_PREORDER) {
+    if (t->root != NULL) { tree_iter_push(it, t->root); }
+    it->cur = NULL;
+  }
+}
+
+//-------------------------------------------------------------------------
+tnode* tree_iter_next(tree_iter* it) {
+  tnode* p;
+
+  switch (it->order) {
+  case TREE_PREORDER:
+    if (it->top == 0) { return NULL; }
+    p = it->stack[--it->top];
+    if (p->right != NULL) { tree_iter_push(it, p->right); }
+    if (p->left != NULL) { tree_iter_push(it, p->left); }
+    return p;
+
+  case TREE_POSTORDER:
+    for (;;) {
+      for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+      if (it->top == 0) { return NULL; }
+
+      p = it->stack[it->top - 1];
+      if (p->right != NULL && p->right != it->last) {
+        it->cur = p->right;
+        continue;
+      }
+      --it->top;
+      it->last = p;
+      return p;
+    }
+
+  default:
+    for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+    if (it->top == 0) { return NULL; }
+
+    p = it->stack[--it->top];
+    it->cur = p->right;
+    return p;
+  }
+}
+
+//-------------------------------------------------------------------------
+//repositions an inorder iterator so the next node returned is the first
+//whose word is >= word[0..len)
+void tree_iter_seek(tree_iter* it, const char* word, size_t len) {
+  tnode* p = it->t->root;
+  it->top = 0;
+  it->cur = NULL;
+
+  while (p != NULL) {
+    if (wordcmp(word, len, p->word) <= 0) {
+      tree_iter_push(it, p);
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_iter_end(tree_iter* it) {
+  if (it->stack != it->small) { free(it->stack); }
+  it->stack = it->small;
+  it->top = 0;
+}
+
 //-------------------------------------------------------------------------
 static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
   int compare;
@@ -84,14 +266,67 @@ static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
 }
 
 //-------------------------------------------------------------------------
+//walks down matching labels; a label that only partly matches is split
+//in two, so every prefix is stored once however many words share it
+static void trie_add(tree* t, const char* w, size_t len) {
+  if (t->trie == NULL) { t->trie = rnode_create("", 0, 0); }
+  rnode* p = t->trie;
+  size_t i = 0;
+
+  while (i < len) {
+    unsigned char c = (unsigned char)w[i];
+    rnode** link = &p->child;
+    while (*link != NULL && (unsigned char)(*link)->label[0] < c) { link = &(*link)->next; }
+
+    rnode* q = *link;
+    if (q == NULL || (unsigned char)q->label[0] != c) {
+      rnode* leaf = rnode_create(w + i, len - i, 1);
+      leaf->next = q;
+      *link = leaf;
+      t->size++;
+      return;
+    }
+
+    size_t k = 1;
+    while (k < q->len && i + k < len && q->label[k] == w[i + k]) { ++k; }
+    if (k < q->len) {
+      rnode* mid = rnode_create(q->label, k, 0);
+      char* rest = (char*)malloc(q->len - k + 1);
+      memcpy(rest, q->label + k, q->len - k + 1);
+      free(q->label);
+      q->label = rest;
+      q->len -= k;
+      mid->child = q;
+      mid->next = q->next;
+      q->next = NULL;
+      *link = mid;
+      q = mid;
+    }
+    p = q;
+    i += k;
+  }
+
+  if (p->count++ == 0) { t->size++; }
+}
+
+//-------------------------------------------------------------------------
+//in TREE_TRIE mode there is no tnode to hand back, so this returns NULL
 tnode* tree_add(tree* t, const char* word) {
-  tnode* p = tree_addnode(t, &(t->root), word);
+  uint64_t t0 = timing_start();
+  tnode* p = NULL;
+
+  if (t->mode == TREE_TRIE) {
+    trie_add(t, word, strlen(word));
+  } else {
+    p = tree_addnode(t, &(t->root), word);
+  }
+  timing_insert(t0);
   return p;
 }
 
 //-------------------------------------------------------------------------
-tree* console_input() {
-  tree* t = tree_create();
+tree* console_input(int mode) {
+  tree* t = tree_create_mode(mode);
 
   char line[BUFSIZ];
   memset(line, 0, BUFSIZ);
@@ -115,8 +350,8 @@ tree* console_input() {
 }
 
 //-------------------------------------------------------------------------
-tree* file_input(const char* filename) {
-  tree* t = tree_create();
+tree* file_input(const char* filename, int mode) {
+  tree* t = tree_create_mode(mode);
 
   FILE* f = fopen(filename, "r");
   if (f == NULL) {
@@ -128,17 +363,24 @@ tree* file_input(const char* filename) {
   char line[BUFSIZ];
   memset(line, 0, BUFSIZ);
 
+  uint64_t t0 = timing_start();
   while (fgets(line, BUFSIZ, f) != NULL) {
+    t0 = timing_stop(PHASE_READ, t0);
     if (*line == '\n') { continue; }
     char* p = strtok(line, ",. !\n");
+    timing_stop(PHASE_TOKENIZE, t0);
     tree_add(t, p);
 
     while (p != NULL) {
+      t0 = timing_start();
       p = strtok(NULL, ",. !\n");
+      timing_stop(PHASE_TOKENIZE, t0);
       if (p == NULL) { continue; }
       tree_add(t, p);
     }
+    t0 = timing_start();
   }
+  timing_stop(PHASE_READ, t0);
 
   fclose(f);
   return t;
@@ -146,9 +388,11 @@ tree* file_input(const char* filename) {
 
 //-------------------------------------------------------------------------
 void tree_clear(tree* t) {
+  uint64_t t0 = timing_start();
   tree_delete(t);
   t->root = NULL;
   t->size = 0;
+  timing_stop(PHASE_CLEAR, t0);
 }
 
 //-------------------------------------------------------------------------
@@ -156,6 +400,56 @@ void tree_print(tnode* p) {
   printf("%s -- %d  (%p, %p)\n", p->word, p->count, p->left, p->right);
 }
 
+//-------------------------------------------------------------------------
+//word being spelled out while walking down the trie
+typedef struct trie_path trie_path;
+struct trie_path {
+  char* buf;
+  size_t len;
+  size_t cap;
+};
+
+//-------------------------------------------------------------------------
+static void trie_path_push(trie_path* path, rnode* p) {
+  if (path->len + p->len + 1 > path->cap) {
+    path->cap = 2 * (path->len + p->len + 1);
+    path->buf = (char*)realloc(path->buf, path->cap);
+  }
+  memcpy(path->buf + path->len, p->label, p->len);
+  path->len += p->len;
+  path->buf[path->len] = '\0';
+}
+
+//-------------------------------------------------------------------------
+static void trie_print(const char* word, rnode* p) {
+  printf("%s -- %d  (%p, %p)\n", word, p->count, (void*)p->child, (void*)p->next);
+}
+
+//-------------------------------------------------------------------------
+//a trie's preorder is already alphabetical; postorder prints a word after
+//every longer word that extends it
+static void trie_printnodes(trie_path* path, rnode* p, int order) {
+  for ( ; p != NULL; p = p->next) {
+    size_t len = path->len;
+    trie_path_push(path, p);
+    if (p->count > 0 && order != TREE_POSTORDER) { trie_print(path->buf, p); }
+    trie_printnodes(path, p->child, order);
+    if (p->count > 0 && order == TREE_POSTORDER) { trie_print(path->buf, p); }
+    path->len = len;
+    path->buf[len] = '\0';
+  }
+}
+
+//-------------------------------------------------------------------------
+static void trie_print_order(tree* t, int order) {
+  if (t->trie == NULL) { return; }
+
+  trie_path path = {NULL, 0, 0};
+  trie_path_push(&path, t->trie);
+  trie_printnodes(&path, t->trie->child, order);
+  free(path.buf);
+}
+
 //-------------------------------------------------------------------------
 static void tree_printnodes_inorder(tree* t, tnode* p) {
   if (p == NULL) { return; }
@@ -167,6 +461,7 @@ static void tree_printnodes_inorder(tree* t, tnode* p) {
 
 //-------------------------------------------------------------------------
 void tree_print_inorder(tree* t) {
+  if (t->mode == TREE_TRIE) { trie_print_order(t, TREE_INORDER); return; }
   tree_printnodes_inorder(t, t->root);
 }
 
@@ -181,6 +476,7 @@ static void tree_printnodes_preorder(tree* t, tnode* p) {
 
 //-------------------------------------------------------------------------
 void tree_print_preorder(tree* t) {
+  if (t->mode == TREE_TRIE) { trie_print_order(t, TREE_PREORDER); return; }
   tree_printnodes_preorder(t, t->root);
 }
 
@@ -195,61 +491,179 @@ static void tree_printnodes_postorder(tree* t, tnode* p) {
 
 //-------------------------------------------------------------------------
 void tree_print_postorder(tree* t) {
+  if (t->mode == TREE_TRIE) { trie_print_order(t, TREE_POSTORDER); return; }
   tree_printnodes_postorder(t, t->root);
 }
 
 //-------------------------------------------------------------------------
-void tree_printnodes_n(tnode* p, int n) {
-  static tnode* prev = NULL;
+//first node whose word is >= key, NULL when every word is smaller
+tnode* tree_lower_bound(tree* t, const char* key) {
+  tnode* p = t->root;
+  tnode* best = NULL;
 
-  if (p != NULL) {
-    tree_printnodes_n(p->left, n);
-    if (prev == NULL) { printf("%s ", p->word); }
+  while (p != NULL) {
+    if (strcmp(key, p->word) <= 0) {
+      best = p;
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+  return best;
+}
 
-    if (prev != NULL) {
-      if (strncmp(prev->word, p->word, n) == 0) {
-        printf("%s ", p->word);
-      }
-      else { printf("\n%s ", p->word); }
+//-------------------------------------------------------------------------
+//first node whose word is > key, NULL when no word is larger
+tnode* tree_upper_bound(tree* t, const char* key) {
+  tnode* p = t->root;
+  tnode* best = NULL;
+
+  while (p != NULL) {
+    if (strcmp(key, p->word) < 0) {
+      best = p;
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+  return best;
+}
+
+//-------------------------------------------------------------------------
+//calls visit on every node whose word starts with the first n letters of
+//prefix, in order, in O(log size + matches). Returns the node following
+//the range (NULL at the end of the tree), where a scan can carry on.
+tnode* tree_prefix_range(tree* t, const char* prefix, size_t n, tree_visit visit, void* arg) {
+  size_t len = strlen(prefix);
+  if (n > len) { n = len; }
+
+  tree_iter it;
+  tnode* p;
+  tree_iter_begin(&it, t, TREE_INORDER);
+  tree_iter_seek(&it, prefix, n);
+
+  while ((p = tree_iter_next(&it)) != NULL && strncmp(p->word, prefix, n) == 0) {
+    visit(p, arg);
+  }
+  tree_iter_end(&it);
+  return p;
+}
+
+//-------------------------------------------------------------------------
+static void tree_print_word(tnode* p, void* arg) {
+  (void)arg;
+  printf("%s ", p->word);
+}
+
+//-------------------------------------------------------------------------
+//prints every word in p's subtree (p included) on the current line
+static void trie_print_words(trie_path* path, rnode* p) {
+  size_t len = path->len;
+  trie_path_push(path, p);
+  if (p->count > 0) { printf("%s ", path->buf); }
+  for (rnode* q = p->child; q != NULL; q = q->next) { trie_print_words(path, q); }
+  path->len = len;
+  path->buf[len] = '\0';
+}
+
+//-------------------------------------------------------------------------
+//the first node whose label reaches depth n roots a whole group; a word
+//ending above depth n is a group of its own. No two words are compared.
+static void trie_print_groups(trie_path* path, rnode* p, size_t n, bool* first) {
+  for ( ; p != NULL; p = p->next) {
+    if (!*first && (path->len + p->len >= n || p->count > 0)) { printf("\n"); }
+
+    if (path->len + p->len >= n) {
+      *first = false;
+      trie_print_words(path, p);
+      continue;
     }
-    prev = p;
+
+    size_t len = path->len;
+    trie_path_push(path, p);
+    if (p->count > 0) {
+      *first = false;
+      printf("%s ", path->buf);
+    }
+    trie_print_groups(path, p->child, n, first);
+    path->len = len;
+    path->buf[len] = '\0';
   }
-  else { return; }
-  tree_printnodes_n(p->right, n);
 }
 
 //-------------------------------------------------------------------------
+//one line per group of words sharing their first n letters. Each group is
+//a prefix range starting where the previous one ended; a word shorter than
+//n letters shares them with no other word and is a group of its own.
 void tree_print_n(tree* t, int n) {
-  if (n == 0) { tree_print_inorder(t); }
-  else { tree_printnodes_n(t->root, n); }
+  if (n == 0) {
+    tree_print_inorder(t);
+    return;
+  }
+
+  if (t->mode == TREE_TRIE) {
+    if (t->trie == NULL) { return; }
+    trie_path path = {NULL, 0, 0};
+    bool first = true;
+    trie_path_push(&path, t->trie);
+    trie_print_groups(&path, t->trie->child, n, &first);
+    free(path.buf);
+    return;
+  }
+
+  tnode* p = tree_lower_bound(t, "");
+  bool first = true;
+  while (p != NULL) {
+    if (!first) { printf("\n"); }
+    first = false;
+
+    if (strlen(p->word) < (size_t)n) {
+      tree_print_word(p, NULL);
+      p = tree_upper_bound(t, p->word);
+    } else {
+      p = tree_prefix_range(t, p->word, n, tree_print_word, NULL);
+    }
+  }
 }
 
 //-------------------------------------------------------------------------
+//./program [-t] [limit [file]]; -t indexes the words in a radix trie
 int main(int argc, const char* argv[]) {
   int lim = COMP_LIMIT;
+  int mode = TREE_PLAIN;
   tree* t = NULL;
 
+  if (argc > 1 && strcmp(argv[1], "-t") == 0) {
+    mode = TREE_TRIE;
+    --argc;
+    ++argv;
+  }
+
   if (argc == 1) {
     printf("Waiting for tree data input:\n");
-    t = console_input();
+    t = console_input(mode);
   }
 
   if (argc == 2) {
     lim = atoi(argv[1]);
     printf("Waiting for tree data input:\n");
-    t = console_input();
+    t = console_input(mode);
   }
 
   if (argc == 3) {
     lim = atoi(argv[1]);
     const char* filename = argv[2];
-    t = file_input(filename);
+    t = file_input(filename, mode);
   }
 
+  uint64_t t0 = timing_start();
   tree_print_inorder(t);
+  timing_stop(PHASE_PRINT, t0);
 
   printf("\nPrinting tree with %d letter comparisons\n\n", lim);
+  t0 = timing_start();
   tree_print_n(t, lim);
+  timing_stop(PHASE_PRINT, t0);
   printf("\nIs my tree empty? %s\n", tree_empty(t) ? "Yes" : "No");
 
   tree_clear(t);
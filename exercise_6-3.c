@@ -4,12 +4,24 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "timing.h"
 
 //-------------------------------------------------------------------------
-typedef struct pnode pnode;
-struct pnode {
-  int line;
-  pnode* next;
+//ascending line numbers of one word; the first two live inline so a word
+//seen on one or two lines needs no extra allocation
+#define POSTINGS_SMALL 2
+
+typedef struct postings postings;
+struct postings {
+  int* lines;
+  int len;
+  int cap;
+  int small[POSTINGS_SMALL];
 };
 
 //-------------------------------------------------------------------------
@@ -17,53 +29,80 @@ typedef struct tnode tnode;
 struct tnode {
   const char* word;
   int count;
-  pnode* lines;
+  postings lines;
   tnode* left;
   tnode* right;
 };
 
+//-------------------------------------------------------------------------
+//read-only view of a snapshot written by tree_save. The arrays point into
+//the mapping, which is shared by every process that loads the image.
+typedef struct tree_image tree_image;
+struct tree_image {
+  const char* base;
+  size_t bytes;
+  size_t size;
+  const uint64_t* offset;   //of each word in words, ascending word order
+  const uint64_t* first;    //word i's lines are lines[first[i], first[i + 1])
+  const int32_t* count;
+  const int32_t* lines;
+  const char* words;
+};
+
 //-------------------------------------------------------------------------
 typedef struct tree tree;
 struct tree {
   tnode* root;
   size_t size;
+  tree_image* image;   //set by tree_load; root is then empty and size counts the image
 };
 
 //-------------------------------------------------------------------------
-pnode* pnode_create(int num) {
-  pnode* p = (pnode*)malloc(sizeof(pnode));
-  p->line = num;
-  p->next = NULL;
-  return p;
+void postings_init(postings* p, int num) {
+  p->lines = p->small;
+  p->len = 1;
+  p->cap = POSTINGS_SMALL;
+  p->small[0] = num;
 }
 
 //-------------------------------------------------------------------------
-void pnode_append(pnode* t, int num) {
-  pnode* p = t;
-  while (p->next != NULL) {
-    p = p->next;
-  }
-  if (p->line != num) {
-    pnode* q = pnode_create(num);
-    p->next = q;
-  }
+static void postings_reserve(postings* p, int cap) {
+  if (cap <= p->cap) { return; }
+
+  int* lines = (int*)malloc(cap * sizeof(int));
+  memcpy(lines, p->lines, p->len * sizeof(int));
+  if (p->lines != p->small) { free(p->lines); }
+  p->lines = lines;
+  p->cap = cap;
 }
 
 //-------------------------------------------------------------------------
-void pnode_delete(pnode* p) {
-  while (p != NULL) {
-    pnode* q = p;
-    p = p->next;
-    free(q);
-  }
+//lines arrive in ascending order, so a repeat of the same line is always
+//the tail and the append is O(1)
+void postings_append(postings* p, int num) {
+  if (p->lines[p->len - 1] == num) { return; }
+
+  if (p->len == p->cap) { postings_reserve(p, p->cap * 2); }
+  p->lines[p->len++] = num;
 }
 
 //-------------------------------------------------------------------------
-tnode* tnode_create(const char* word, int line_num) {
+void postings_delete(postings* p) {
+  if (p->lines != p->small) { free(p->lines); }
+  p->lines = p->small;
+  p->len = 0;
+  p->cap = POSTINGS_SMALL;
+}
+
+//-------------------------------------------------------------------------
+tnode* tnode_create(const char* word, size_t len, int line_num) {
   tnode* p = (tnode*)malloc(sizeof(tnode));
-  p->word = strdup(word);   //copy of word allocated on heap
+  char* s = (char*)malloc(len + 1);   //copy of word allocated on heap
+  memcpy(s, word, len);
+  s[len] = '\0';
+  p->word = s;
   p->count = 1;
-  p->lines = pnode_create(line_num);
+  postings_init(&p->lines, line_num);
   p->left = NULL;
   p->right = NULL;
   return p;
@@ -72,7 +111,7 @@ tnode* tnode_create(const char* word, int line_num) {
 //-------------------------------------------------------------------------
 void tnode_delete(tnode* t) {
   free((void*)t->word);
-  pnode_delete(t->lines);
+  postings_delete(&t->lines);
   free(t);
 }
 
@@ -81,6 +120,7 @@ tree* tree_create() {
   tree* p = (tree*)malloc(sizeof(tree));
   p->root = NULL;
   p->size = 0;
+  p->image = NULL;
   return p;
 }
 
@@ -104,32 +144,217 @@ bool tree_empty(tree* t) { return t->size == 0; }
 size_t tree_size(tree* t) { return t->size; }
 
 //-------------------------------------------------------------------------
-bool noise_word(const char* w) {
-  const char* noise[] = {"a","an","and","be","but","by","he","I","is"
-                       ,"it","of","off","on","she","so","the","they","you"};
-                       
-  int size = sizeof(noise)/sizeof(noise[0]);
-  for (int i = 0; i < size; ++i) {
-    if (strcmp(w, noise[i]) == 0)
-      return true;
+//stopword set as a perfect hash (hash and displace): a word's bucket picks
+//a displacement that sends every word of that bucket to its own slot, so
+//a lookup is one hash, one slot and at most one memcmp
+typedef struct stopset stopset;
+struct stopset {
+  const char** words;     //m slots, NULL when empty
+  size_t* lens;
+  unsigned* disp;         //r buckets
+  size_t m;
+  size_t r;
+  size_t minlen;
+  size_t maxlen;
+  unsigned long long seed;
+  char* storage;          //word bytes when loaded from a file
+};
+
+static const char* noise_builtin[] = {"a","an","and","be","but","by","he","I","is"
+                                     ,"it","of","off","on","she","so","the","they","you"};
+static stopset* stopwords = NULL;
+
+//-------------------------------------------------------------------------
+static unsigned long long stop_hash(const char* w, size_t len, unsigned long long seed) {
+  unsigned long long h = 14695981039346656037ULL ^ seed;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)w[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;   //fmix64, so every bit of the word reaches every hash bit
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+//-------------------------------------------------------------------------
+static size_t stop_slot(const stopset* s, unsigned long long h, unsigned d) {
+  unsigned long long h1 = h >> 20, h2 = (h >> 40) | 1;
+  return (size_t)((h1 + d * h2) & (s->m - 1));
+}
+
+//-------------------------------------------------------------------------
+static size_t pow2_at_least(size_t n) {
+  size_t p = 1;
+  while (p < n) { p *= 2; }
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//places buckets largest first, trying displacements until one fits; on
+//the rare dead end it starts over with a new seed. Repeated words are kept
+//once. Returns false only if no seed works.
+static bool stopset_place(stopset* s, const char** words, const size_t* lens, size_t n) {
+  size_t* bucket_of = (size_t*)malloc((n + 1) * sizeof(size_t));
+  size_t* sizes = (size_t*)calloc(s->r, sizeof(size_t));
+  size_t* order = (size_t*)malloc(s->r * sizeof(size_t));
+  size_t* first = (size_t*)malloc((s->r + 1) * sizeof(size_t));
+  size_t* members = (size_t*)malloc((n + 1) * sizeof(size_t));
+  size_t* slots = (size_t*)malloc((n + 1) * sizeof(size_t));
+  bool placed = false;
+
+  for (int attempt = 0; attempt < 64 && !placed; ++attempt) {
+    s->seed = 0x9e3779b97f4a7c15ULL * (attempt + 1);
+    memset(sizes, 0, s->r * sizeof(size_t));
+    memset(s->words, 0, s->m * sizeof(const char*));
+
+    for (size_t i = 0; i < n; ++i) {
+      bucket_of[i] = stop_hash(words[i], lens[i], s->seed) & (s->r - 1);
+      sizes[bucket_of[i]]++;
+    }
+    size_t largest = 0, k = 0;
+    first[0] = 0;
+    for (size_t b = 0; b < s->r; ++b) {
+      first[b + 1] = first[b] + sizes[b];
+      if (sizes[b] > largest) { largest = sizes[b]; }
+    }
+    for (size_t i = 0; i < n; ++i) { members[--first[bucket_of[i] + 1]] = i; }
+    for (size_t b = 0; b < s->r; ++b) { first[b + 1] = first[b] + sizes[b]; }
+    for (size_t sz = largest; sz > 0; --sz) {   //buckets are tiny, so this is cheap
+      for (size_t b = 0; b < s->r; ++b) {
+        if (sizes[b] == sz) { order[k++] = b; }
+      }
+    }
+
+    placed = true;
+    for (size_t o = 0; o < k; ++o) {
+      size_t b = order[o];
+
+      unsigned d = 0;
+      for ( ; d < (1u << 16); ++d) {
+        size_t used = 0;
+        bool ok = true;
+        for (size_t x = first[b]; x < first[b + 1] && ok; ++x) {
+          size_t i = members[x];
+          bool dup = false;
+          for (size_t y = first[b]; y < x; ++y) {
+            size_t j = members[y];
+            if (lens[j] == lens[i] && memcmp(words[j], words[i], lens[i]) == 0) { dup = true; }
+          }
+          if (dup) { continue; }
+
+          size_t slot = stop_slot(s, stop_hash(words[i], lens[i], s->seed), d);
+          ok = s->words[slot] == NULL;
+          for (size_t u = 0; u < used && ok; ++u) { ok = slots[u] != slot; }
+          if (ok) { slots[used++] = slot; }
+        }
+        if (ok) { break; }
+      }
+      if (d == (1u << 16)) {
+        placed = false;
+        break;
+      }
+
+      s->disp[b] = d;
+      for (size_t x = first[b]; x < first[b + 1]; ++x) {
+        size_t i = members[x];
+        size_t slot = stop_slot(s, stop_hash(words[i], lens[i], s->seed), d);
+        if (s->words[slot] != NULL) { continue; }   //a repeated word
+        s->words[slot] = words[i];
+        s->lens[slot] = lens[i];
+      }
+    }
+  }
+
+  free(bucket_of);
+  free(sizes);
+  free(order);
+  free(first);
+  free(members);
+  free(slots);
+  return placed;
+}
+
+//-------------------------------------------------------------------------
+stopset* stopset_create(const char** words, const size_t* lens, size_t n, char* storage) {
+  stopset* s = (stopset*)malloc(sizeof(stopset));
+  s->m = pow2_at_least(2 * n + 1);
+  s->r = pow2_at_least(n / 4 + 1);
+  s->words = (const char**)malloc(s->m * sizeof(const char*));
+  s->lens = (size_t*)calloc(s->m, sizeof(size_t));
+  s->disp = (unsigned*)calloc(s->r, sizeof(unsigned));
+  s->storage = storage;
+  s->minlen = (size_t)-1;
+  s->maxlen = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (lens[i] < s->minlen) { s->minlen = lens[i]; }
+    if (lens[i] > s->maxlen) { s->maxlen = lens[i]; }
+  }
+
+  if (!stopset_place(s, words, lens, n)) {
+    fprintf(stderr, "Could not build stopword table\n");
+    exit(1);
   }
+  return s;
+}
+
+//-------------------------------------------------------------------------
+void stopset_delete(stopset* s) {
+  if (s == NULL) { return; }
 
-  return false;
+  free(s->words);
+  free(s->lens);
+  free(s->disp);
+  free(s->storage);
+  free(s);
 }
 
 //-------------------------------------------------------------------------
-static tnode* tree_addnode(tree* t, tnode** p, const char* w, int lineNum) {
+bool stopset_contains(const stopset* s, const char* w, size_t len) {
+  if (len < s->minlen || len > s->maxlen) { return false; }
+
+  unsigned long long h = stop_hash(w, len, s->seed);
+  size_t slot = stop_slot(s, h, s->disp[h & (s->r - 1)]);
+  return s->words[slot] != NULL && s->lens[slot] == len
+      && memcmp(s->words[slot], w, len) == 0;
+}
+
+//-------------------------------------------------------------------------
+//the built-in list is hashed once, on first use
+bool noise_word(const char* w, size_t len) {
+  if (stopwords == NULL) {
+    size_t n = sizeof(noise_builtin)/sizeof(noise_builtin[0]);
+    size_t lens[sizeof(noise_builtin)/sizeof(noise_builtin[0])];
+    for (size_t i = 0; i < n; ++i) { lens[i] = strlen(noise_builtin[i]); }
+    stopwords = stopset_create(noise_builtin, lens, n, NULL);
+  }
+  return stopset_contains(stopwords, w, len);
+}
+
+//-------------------------------------------------------------------------
+//strcmp of the word view w[0..len) against the NUL-terminated s; never
+//reads past the end of s, even if the view holds a NUL
+static int wordcmp(const char* w, size_t len, const char* s) {
+  size_t n = strnlen(s, len);
+  int compare = memcmp(w, s, n);
+  if (compare != 0) { return compare; }
+  if (n < len) { return 1; }
+  return s[len] == '\0' ? 0 : -1;
+}
+
+//-------------------------------------------------------------------------
+static tnode* tree_addnode(tree* t, tnode** p, const char* w, size_t len, int lineNum) {
   int compare;
 
   if (*p == NULL) {
-    *p = tnode_create(w, lineNum);
+    *p = tnode_create(w, len, lineNum);
     t->size++;
-  } else if ((compare = strcmp(w, (*p)->word)) == 0) {
+  } else if ((compare = wordcmp(w, len, (*p)->word)) == 0) {
     (*p)->count++;
-    pnode_append((*p)->lines, lineNum);
-  } else if (compare < 0) { tree_addnode(t, &(*p)->left, w, lineNum);
+    postings_append(&(*p)->lines, lineNum);
+  } else if (compare < 0) { tree_addnode(t, &(*p)->left, w, len, lineNum);
   } else {
-    tree_addnode(t, &(*p)->right, w, lineNum);
+    tree_addnode(t, &(*p)->right, w, len, lineNum);
   }
 
   return *p;
@@ -137,7 +362,13 @@ static tnode* tree_addnode(tree* t, tnode** p, const char* w, int lineNum) {
 
 //-------------------------------------------------------------------------
 tnode* tree_add(tree* t, const char* word, int cur_line) {
-  tnode* p = tree_addnode(t, &(t->root), word, cur_line);
+  tnode* p = tree_addnode(t, &(t->root), word, strlen(word), cur_line);
+  return p;
+}
+
+//-------------------------------------------------------------------------
+tnode* tree_addn(tree* t, const char* word, size_t len, int cur_line) {
+  tnode* p = tree_addnode(t, &(t->root), word, len, cur_line);
   return p;
 }
 
@@ -145,12 +376,12 @@ tnode* tree_add(tree* t, const char* word, int cur_line) {
 void console_input(tree* t, int argc, const char* argv[]) {
   int i = 1;
   char* p = strtok((char*)argv[i++], ",. !");
-  if (!noise_word(p))
+  if (!noise_word(p, strlen(p)))
     tree_add(t, p, 1);
 
   while (p != NULL && i < argc) {
     p = strtok((char*)argv[i], ", .!");
-    if (!noise_word(p))
+    if (!noise_word(p, strlen(p)))
       tree_add(t, p, 1);
     ++i;
   }
@@ -173,13 +404,13 @@ void file_input(tree* t, const char* filename) {
     ++lineCount;
     if (*line == '\n') { continue; }
     char* p = strtok(line, ",. !\n");
-    if (!noise_word(p))
+    if (!noise_word(p, strlen(p)))
       tree_add(t, p, lineCount);
 
     while (p != NULL) {
       p = strtok(NULL, ",. !\n");
       if (p == NULL) { continue; }
-      if (!noise_word(p))
+      if (!noise_word(p, strlen(p)))
         tree_add(t, p, lineCount);
     }
   }
@@ -187,6 +418,105 @@ void file_input(tree* t, const char* filename) {
   fclose(f);
 }
 
+//-------------------------------------------------------------------------
+static bool is_delim(char c) {
+  return c == ',' || c == '.' || c == ' ' || c == '!' || c == '\n' || c == '\0';
+}
+
+//-------------------------------------------------------------------------
+//returns the start of the next word in [p, end) and its length in *len,
+//or NULL when only delimiters remain
+const char* token_next(const char* p, const char* end, size_t* len) {
+  while (p < end && is_delim(*p)) { ++p; }
+  if (p == end) { return NULL; }
+
+  const char* q = p;
+  while (q < end && !is_delim(*q)) { ++q; }
+  *len = q - p;
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//maps the whole file and tokenizes it in place; line numbers count real
+//newlines, so lines longer than BUFSIZ are no longer split
+void file_input_mmap(tree* t, const char* filename) {
+  uint64_t t0 = timing_start();
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Error opening file: %s\n", filename);
+    exit(1);
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  const char* base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Error mapping file: %s\n", filename);
+    exit(1);
+  }
+  madvise((void*)base, st.st_size, MADV_SEQUENTIAL);
+  timing_stop(PHASE_READ, t0);
+
+  const char* p = base;
+  const char* end = base + st.st_size;
+  int lineCount = 1;
+  while (p < end) {
+    t0 = timing_start();
+    while (p < end && is_delim(*p)) {
+      if (*p++ == '\n') { ++lineCount; }
+    }
+    const char* w = p;
+    while (p < end && !is_delim(*p)) { ++p; }
+    bool keep = p > w && !noise_word(w, p - w);
+    t0 = timing_stop(PHASE_TOKENIZE, t0);
+    if (keep) {
+      tree_addn(t, w, p - w, lineCount);
+      timing_insert(t0);
+    }
+  }
+
+  munmap((void*)base, st.st_size);
+  close(fd);
+}
+
+//-------------------------------------------------------------------------
+//replaces the built-in noise words with those listed in filename
+void stopset_load(const char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Error opening file: %s\n", filename);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* storage = (char*)malloc(size + 1);
+  size = fread(storage, 1, size, f);
+  fclose(f);
+
+  size_t n = 0, cap = 256, len;
+  const char** words = (const char**)malloc(cap * sizeof(const char*));
+  size_t* lens = (size_t*)malloc(cap * sizeof(size_t));
+  const char* end = storage + size;
+  for (const char* p = storage; (p = token_next(p, end, &len)) != NULL; p += len) {
+    if (n == cap) {
+      cap *= 2;
+      words = (const char**)realloc(words, cap * sizeof(const char*));
+      lens = (size_t*)realloc(lens, cap * sizeof(size_t));
+    }
+    words[n] = p;
+    lens[n++] = len;
+  }
+
+  stopset_delete(stopwords);
+  stopwords = stopset_create(words, lens, n, storage);
+  free(words);
+  free(lens);
+}
+
 //-------------------------------------------------------------------------
 tree* get_input(int argc, const char* argv[]) {
   tree* t = tree_create();
@@ -198,7 +528,7 @@ tree* get_input(int argc, const char* argv[]) {
 
   if (argc == 2) {
     const char* filename = argv[1];
-    file_input(t, filename);
+    file_input_mmap(t, filename);
   }
 
   if (argc > 2) {
@@ -207,25 +537,207 @@ tree* get_input(int argc, const char* argv[]) {
   return t;
 }
 
+//-------------------------------------------------------------------------
+static void print_entry(const char* word, int count, const int* lines, int len) {
+  printf("%d -- %s  ", count, word);
+  if (len > 0) {
+    printf("[");
+    for (int i = 0; i < len; ++i) {
+      if (i == len - 1) printf("%d]\n", lines[i]);
+      else printf("%d, ", lines[i]);
+    }
+  } else printf("Rogue word\n");
+}
+
+//-------------------------------------------------------------------------
+//snapshot layout: header, uint64 word offsets, uint64 line offsets (one
+//extra at the end), int32 counts, int32 lines, then the word blob
+#define XREF_IMAGE_MAGIC "XREFIMG1"
+
+typedef struct image_header image_header;
+struct image_header {
+  char magic[8];
+  uint64_t size;
+  uint64_t lines;
+  uint64_t bytes;    //of the word blob
+};
+
+//-------------------------------------------------------------------------
+//in-order nodes of t's tree into out, with an explicit stack so a
+//degenerate tree cannot overflow the call stack
+static size_t tree_flatten(tree* t, tnode** out) {
+  tnode** stack = (tnode**)malloc((t->size + 1) * sizeof(tnode*));
+  size_t top = 0, i = 0;
+  tnode* p = t->root;
+
+  while (p != NULL || top > 0) {
+    while (p != NULL) {
+      stack[top++] = p;
+      p = p->left;
+    }
+    p = stack[--top];
+    out[i++] = p;
+    p = p->right;
+  }
+  free(stack);
+  return i;
+}
+
+//-------------------------------------------------------------------------
+//a tree served from an image has no nodes, so its mapping is copied as is
+static void image_write(tree* t, FILE* f) {
+  if (t->image != NULL) {
+    fwrite(t->image->base, 1, t->image->bytes, f);
+    return;
+  }
+
+  tnode** v = (tnode**)malloc((t->size + 1) * sizeof(tnode*));
+  size_t n = tree_flatten(t, v);
+  image_header h = {XREF_IMAGE_MAGIC, n, 0, 0};
+  for (size_t i = 0; i < n; ++i) {
+    h.lines += v[i]->lines.len;
+    h.bytes += strlen(v[i]->word) + 1;
+  }
+
+  fwrite(&h, sizeof(h), 1, f);
+  uint64_t offset = 0;
+  for (size_t i = 0; i < n; ++i) {
+    fwrite(&offset, sizeof(offset), 1, f);
+    offset += strlen(v[i]->word) + 1;
+  }
+  offset = 0;
+  for (size_t i = 0; i <= n; ++i) {
+    fwrite(&offset, sizeof(offset), 1, f);
+    if (i < n) { offset += v[i]->lines.len; }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    int32_t count = v[i]->count;
+    fwrite(&count, sizeof(count), 1, f);
+  }
+  for (size_t i = 0; i < n; ++i) { fwrite(v[i]->lines.lines, sizeof(int32_t), v[i]->lines.len, f); }
+  for (size_t i = 0; i < n; ++i) { fwrite(v[i]->word, 1, strlen(v[i]->word) + 1, f); }
+  free(v);
+}
+
+//-------------------------------------------------------------------------
+//writes filename.tmp and renames it over filename, so a process loading
+//the image never sees a partial one
+void tree_save(tree* t, const char* filename) {
+  size_t len = strlen(filename);
+  char* tmp = (char*)malloc(len + 5);
+  memcpy(tmp, filename, len);
+  memcpy(tmp + len, ".tmp", 5);
+  FILE* f = fopen(tmp, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Error opening file: %s\n", tmp);
+    exit(1);
+  }
+
+  image_write(t, f);
+
+  if (ferror(f) || fclose(f) != 0 || rename(tmp, filename) < 0) {
+    fprintf(stderr, "Error writing file: %s\n", filename);
+    exit(1);
+  }
+  free(tmp);
+}
+
+//-------------------------------------------------------------------------
+//word offsets must start at 0 and strictly ascend inside the blob, so every
+//word is in bounds and NUL-terminated by the next one (or the final NUL)
+static bool image_offsets_valid(const uint64_t* offset, uint64_t n, uint64_t bytes) {
+  if (n > 0 && offset[0] != 0) { return false; }
+  for (uint64_t i = 0; i < n; ++i) {
+    if (offset[i] >= bytes || (i > 0 && offset[i] <= offset[i - 1])) { return false; }
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+//line ranges must start at 0, never go backwards and end at the total
+static bool image_first_valid(const uint64_t* first, uint64_t n, uint64_t lines) {
+  if (first[0] != 0 || first[n] != lines) { return false; }
+  for (uint64_t i = 0; i < n; ++i) {
+    if (first[i + 1] < first[i]) { return false; }
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+//maps a snapshot read-only into an otherwise empty tree; NULL, with a
+//message, if the file is not a valid image
+tree* tree_load(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Error opening file: %s\n", filename);
+    exit(1);
+  }
+
+  size_t bytes = st.st_size;
+  const char* base = bytes < sizeof(image_header) ? MAP_FAILED
+                   : (const char*)mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  const image_header* h = (const image_header*)base;
+  if (base == MAP_FAILED || memcmp(h->magic, XREF_IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->size > bytes / sizeof(uint64_t) || h->lines > bytes / sizeof(int32_t) ||
+      bytes != sizeof(image_header) + h->size * (2 * sizeof(uint64_t) + sizeof(int32_t)) +
+               sizeof(uint64_t) + h->lines * sizeof(int32_t) + h->bytes ||
+      (h->bytes > 0 && base[bytes - 1] != '\0') ||
+      !image_offsets_valid((const uint64_t*)(base + sizeof(image_header)), h->size, h->bytes) ||
+      !image_first_valid((const uint64_t*)(base + sizeof(image_header)) + h->size, h->size, h->lines)) {
+    fprintf(stderr, "Not a cross-reference image: %s\n", filename);
+    if (base != MAP_FAILED) { munmap((void*)base, bytes); }
+    return NULL;
+  }
+  madvise((void*)base, bytes, MADV_WILLNEED);
+
+  tree_image* img = (tree_image*)malloc(sizeof(tree_image));
+  img->base = base;
+  img->bytes = bytes;
+  img->size = h->size;
+  img->offset = (const uint64_t*)(base + sizeof(image_header));
+  img->first = img->offset + h->size;
+  img->count = (const int32_t*)(img->first + h->size + 1);
+  img->lines = img->count + h->size;
+  img->words = (const char*)(img->lines + h->lines);
+
+  tree* t = tree_create();
+  t->image = img;
+  t->size = img->size;
+  return t;
+}
+
+//-------------------------------------------------------------------------
+//index of w in the image, img->size when it is not there
+static size_t image_find(const tree_image* img, const char* w, size_t len) {
+  size_t lo = 0, hi = img->size;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (wordcmp(w, len, img->words + img->offset[mid]) > 0) { lo = mid + 1; } else { hi = mid; }
+  }
+  if (lo < img->size && wordcmp(w, len, img->words + img->offset[lo]) == 0) { return lo; }
+  return img->size;
+}
+
 //-------------------------------------------------------------------------
 void tree_clear(tree* t) {
+  uint64_t t0 = timing_start();
+  if (t->image != NULL) {
+    munmap((void*)t->image->base, t->image->bytes);
+    free(t->image);
+    t->image = NULL;
+  }
   tree_delete(t);
   t->root = NULL;
   t->size = 0;
+  timing_stop(PHASE_CLEAR, t0);
 }
 
 //-------------------------------------------------------------------------
 void tree_print(tnode* p) {
-  printf("%d -- %s  ", p->count, p->word);
-  pnode* q = p->lines;
-  if (q != NULL) {
-    printf("[");
-    while (q != NULL) {
-      if(q->next == NULL) printf("%d]\n", q->line);
-      else printf("%d, ", q->line);
-      q = q->next;
-    }
-  } else printf("Rogue word\n");
+  print_entry(p->word, p->count, p->lines.lines, p->lines.len);
 }
 
 //-------------------------------------------------------------------------
@@ -239,6 +751,14 @@ static void tree_printnodes_inorder(tree* t, tnode* p) {
 
 //-------------------------------------------------------------------------
 void tree_print_inorder(tree* t) {
+  const tree_image* img = t->image;
+  if (img != NULL) {
+    for (size_t i = 0; i < img->size; ++i) {
+      print_entry(img->words + img->offset[i], img->count[i], img->lines + img->first[i],
+                  (int)(img->first[i + 1] - img->first[i]));
+    }
+    return;
+  }
   tree_printnodes_inorder(t, t->root);
 }
 
@@ -271,15 +791,248 @@ void tree_print_postorder(tree* t) {
 }
 
 //-------------------------------------------------------------------------
+tnode* tree_find(tree* t, const char* w, size_t len) {
+  tnode* p = t->root;
+  int compare;
+
+  while (p != NULL && (compare = wordcmp(w, len, p->word)) != 0) {
+    p = compare < 0 ? p->left : p->right;
+  }
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//ascending line numbers produced by a query
+typedef struct lineset lineset;
+struct lineset {
+  int* lines;
+  int len;
+};
+
+//-------------------------------------------------------------------------
+//first index i >= lo with v[i] >= x: doubles the step from lo until it
+//overshoots, then binary searches the last step, so skipping d entries
+//costs O(log d) instead of d
+static int gallop(const int* v, int lo, int n, int x) {
+  int step = 1, hi = lo;
+
+  while (hi < n && v[hi] < x) {
+    lo = hi + 1;
+    hi += step;
+    step *= 2;
+  }
+  if (hi > n) { hi = n; }
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (v[mid] < x) { lo = mid + 1; } else { hi = mid; }
+  }
+  return lo;
+}
+
+//-------------------------------------------------------------------------
+//walks the shorter list and gallops through the longer one
+static lineset lines_and(lineset a, lineset b) {
+  if (a.len > b.len) {
+    lineset swap = a;
+    a = b;
+    b = swap;
+  }
+
+  lineset r = {(int*)malloc((a.len + 1) * sizeof(int)), 0};
+  int j = 0;
+  for (int i = 0; i < a.len && j < b.len; ++i) {
+    j = gallop(b.lines, j, b.len, a.lines[i]);
+    if (j < b.len && b.lines[j] == a.lines[i]) { r.lines[r.len++] = a.lines[i]; }
+  }
+  return r;
+}
+
+//-------------------------------------------------------------------------
+static lineset lines_or(lineset a, lineset b) {
+  lineset r = {(int*)malloc((a.len + b.len + 1) * sizeof(int)), 0};
+  int i = 0, j = 0;
+
+  while (i < a.len || j < b.len) {
+    if (j == b.len || (i < a.len && a.lines[i] < b.lines[j])) {
+      r.lines[r.len++] = a.lines[i++];
+    } else if (i == a.len || b.lines[j] < a.lines[i]) {
+      r.lines[r.len++] = b.lines[j++];
+    } else {
+      r.lines[r.len++] = a.lines[i++];
+      ++j;
+    }
+  }
+  return r;
+}
+
+//-------------------------------------------------------------------------
+//lines of a that are not in b, galloping through b
+static lineset lines_not(lineset a, lineset b) {
+  lineset r = {(int*)malloc((a.len + 1) * sizeof(int)), 0};
+  int j = 0;
+
+  for (int i = 0; i < a.len; ++i) {
+    j = gallop(b.lines, j, b.len, a.lines[i]);
+    if (j == b.len || b.lines[j] != a.lines[i]) { r.lines[r.len++] = a.lines[i]; }
+  }
+  return r;
+}
+
+//-------------------------------------------------------------------------
+static lineset lines_of(tree* t, const char* w, size_t len) {
+  lineset r = {NULL, 0};
+  const tree_image* img = t->image;
+  if (img != NULL) {
+    size_t i = image_find(img, w, len);
+    if (i < img->size) {
+      r.lines = (int*)(img->lines + img->first[i]);
+      r.len = (int)(img->first[i + 1] - img->first[i]);
+    }
+    return r;
+  }
+
+  tnode* p = tree_find(t, w, len);
+  if (p != NULL) {
+    r.lines = p->lines.lines;
+    r.len = p->lines.len;
+  }
+  return r;
+}
+
+//-------------------------------------------------------------------------
+static bool query_op(const char* w, size_t len, const char* op) {
+  return strlen(op) == len && strncmp(w, op, len) == 0;
+}
+
+//-------------------------------------------------------------------------
+//evaluates "word [AND|OR|NOT word]..." left to right straight from the
+//postings; two words side by side mean AND. Returns false on a syntax error:
+//an operator first, last, or right after another operator.
+bool tree_query(tree* t, const char* q, lineset* result) {
+  const char* end = q + strlen(q);
+  lineset acc = {NULL, 0};
+  bool owned = false, have = false, pending = false, bad = false;
+  int op = 'A';
+  size_t len;
+
+  while ((q = token_next(q, end, &len)) != NULL) {
+    const char* w = q;
+    q += len;
+    int word_op = query_op(w, len, "AND") ? 'A'
+                : query_op(w, len, "OR") ? 'O'
+                : query_op(w, len, "NOT") ? 'N' : 0;
+    if (word_op != 0) {
+      if (!have || pending) {
+        bad = true;
+        break;
+      }
+      op = word_op;
+      pending = true;
+      continue;
+    }
+
+    lineset term = lines_of(t, w, len);
+    pending = false;
+    if (!have) {
+      acc = term;
+      have = true;
+      continue;
+    }
+
+    lineset next = op == 'O' ? lines_or(acc, term)
+                 : op == 'N' ? lines_not(acc, term)
+                 : lines_and(acc, term);
+    if (owned) { free(acc.lines); }
+    acc = next;
+    owned = true;
+    op = 'A';
+  }
+
+  if (bad || !have || pending) {
+    if (owned) { free(acc.lines); }
+    return false;
+  }
+  if (!owned) {   //a single word: copy so the caller always owns the result
+    int* lines = (int*)malloc((acc.len + 1) * sizeof(int));
+    if (acc.len > 0) { memcpy(lines, acc.lines, acc.len * sizeof(int)); }
+    acc.lines = lines;
+  }
+  *result = acc;
+  return true;
+}
+
+//-------------------------------------------------------------------------
+//answers one query per line of stdin against the resident index
+void tree_query_loop(tree* t) {
+  char line[BUFSIZ];
+
+  while (fgets(line, BUFSIZ, stdin) != NULL) {
+    lineset r;
+    if (!tree_query(t, line, &r)) {
+      printf("Bad query, expected: word [AND|OR|NOT word]...\n");
+      continue;
+    }
+    printf("[");
+    for (int i = 0; i < r.len; ++i) {
+      printf(i == r.len - 1 ? "%d" : "%d, ", r.lines[i]);
+    }
+    printf("]\n");
+    free(r.lines);
+  }
+}
+
+//-------------------------------------------------------------------------
+//./program [-q] [-s stopfile] [-o image] file/keyboard input
+//./program [-q] -i image
+//-q reads boolean line queries from stdin, -s replaces the noise words,
+//-o saves the index as a snapshot image and -i serves one instead of input
 int main(int argc, const char* argv[]) {
+  bool query = false;
+  const char* save = NULL;
+  const char* load = NULL;
+  while (argc > 2 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-q") == 0) {
+      query = true;
+    } else if (strcmp(argv[1], "-s") == 0 && argc > 3) {
+      stopset_load(argv[2]);
+      --argc;
+      ++argv;
+    } else if (strcmp(argv[1], "-o") == 0 && argc > 3) {
+      save = argv[2];
+      --argc;
+      ++argv;
+    } else if (strcmp(argv[1], "-i") == 0) {
+      load = argv[2];
+      --argc;
+      ++argv;
+    } else {
+      break;
+    }
+    --argc;
+    ++argv;
+  }
 
-  tree* t = get_input(argc, argv);
+  tree* t;
+  if (load != NULL) {
+    t = tree_load(load);
+    if (t == NULL) { exit(1); }
+  } else {
+    t = get_input(argc, argv);
+  }
+  if (save != NULL) { tree_save(t, save); }
 
-  tree_print_inorder(t);
+  if (query) { tree_query_loop(t); }
+  else {
+    uint64_t t0 = timing_start();
+    tree_print_inorder(t);
+    timing_stop(PHASE_PRINT, t0);
+  }
 
   tree_clear(t);
 
   free(t);
+  stopset_delete(stopwords);
 
   return 0;
 }
@@ -3,23 +3,51 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
-
-#define MAX_FREQ 200
+#include "timing.h"
 
 //-------------------------------------------------------------------------
 typedef struct tnode tnode;
 struct tnode {
   const char* word;
   int count;
+  int heap_pos;      //index in the top-K heap, -1 when not in it
   tnode* left;
   tnode* right;
 };
 
+//-------------------------------------------------------------------------
+//the K most frequent nodes so far, as a min-heap whose root is the
+//weakest of them
+typedef struct topk topk;
+struct topk {
+  tnode** heap;
+  int len;
+  int k;
+};
+
 //-------------------------------------------------------------------------
 typedef struct tree tree;
 struct tree {
   tnode* root;
   size_t size;
+  topk* top;         //NULL unless top-K tracking is on
+};
+
+//-------------------------------------------------------------------------
+enum tree_order { TREE_INORDER, TREE_PREORDER, TREE_POSTORDER };
+
+#define TREE_ITER_SMALL 64
+
+//-------------------------------------------------------------------------
+typedef struct tree_iter tree_iter;
+struct tree_iter {
+  tnode** stack;
+  size_t top;
+  size_t cap;
+  int order;
+  tnode* cur;
+  tnode* last;       //last node returned, for postorder
+  tnode* small[TREE_ITER_SMALL];
 };
 
 //-------------------------------------------------------------------------
@@ -27,6 +55,7 @@ tnode* tnode_create(const char* word) {
   tnode* p = (tnode*)malloc(sizeof(tnode));
   p->word = strdup(word);   //copy of word allocated on heap
   p->count = 1;
+  p->heap_pos = -1;
   p->left = NULL;
   p->right = NULL;
   return p;
@@ -43,40 +72,199 @@ tree* tree_create() {
   tree* p = (tree*)malloc(sizeof(tree));
   p->root = NULL;
   p->size = 0;
+  p->top = NULL;
   return p;
 }
 
 //-------------------------------------------------------------------------
+//rotates each left child up until the node has none, then frees it, so the
+//teardown needs neither recursion nor a stack
 static void tree_deletenodes(tree* t, tnode* p) {
-  if ( p == NULL) { return; }
-
-  tree_deletenodes(t, p->left);
-  tree_deletenodes(t, p->right);
-  tnode_delete(p);
-  t->size--;
+  while (p != NULL) {
+    tnode* q;
+    if (p->left != NULL) {
+      q = p->left;
+      p->left = q->right;
+      q->right = p;
+    } else {
+      q = p->right;
+      tnode_delete(p);
+      t->size--;
+    }
+    p = q;
+  }
 }
 
 //-------------------------------------------------------------------------
 void tree_delete(tree* t) { tree_deletenodes(t, t->root); }
 
+
+//-------------------------------------------------------------------------
+bool tree_empty(tree* t) { return t->size == 0; }
+
+//-------------------------------------------------------------------------
+size_t tree_size(tree* t) { return t->size; }
+
+//-------------------------------------------------------------------------
+static void tree_iter_push(tree_iter* it, tnode* p) {
+  if (it->top == it->cap) {
+    size_t cap = it->cap * 2;
+    tnode** stack = (tnode**)malloc(cap * sizeof(tnode*));
+    memcpy(stack, it->stack, it->top * sizeof(tnode*));
+    if (it->stack != it->small) { free(it->stack); }
+    it->stack = stack;
+    it->cap = cap;
+  }
+  it->stack[it->top++] = p;
+}
+
 //-------------------------------------------------------------------------
-void tree_freq_delete(tree* tr[]) {
-  for (int i = 1; i < MAX_FREQ; ++i) {
-    tree* t = tr[i];
+void tree_iter_begin(tree_iter* it, tree* t, int order) {
+  it->stack = it->small;
+  it->top = 0;
+  it->cap = TREE_ITER_SMALL;
+  it->order = order;
+  it->cur = t->root;
+  it->last = NULL;
+
+  if (order == TREE_PREORDER) {
+    if (t->root != NULL) { tree_iter_push(it, t->root); }
+    it->cur = NULL;
+  }
+}
 
-    if (t != NULL) {
-      tree_delete(t);
-      t = NULL;
+//-------------------------------------------------------------------------
+tnode* tree_iter_next(tree_iter* it) {
+  tnode* p;
+
+  switch (it->order) {
+  case TREE_PREORDER:
+    if (it->top == 0) { return NULL; }
+    p = it->stack[--it->top];
+    if (p->right != NULL) { tree_iter_push(it, p->right); }
+    if (p->left != NULL) { tree_iter_push(it, p->left); }
+    return p;
+
+  case TREE_POSTORDER:
+    for (;;) {
+      for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+      if (it->top == 0) { return NULL; }
+
+      p = it->stack[it->top - 1];
+      if (p->right != NULL && p->right != it->last) {
+        it->cur = p->right;
+        continue;
+      }
+      --it->top;
+      it->last = p;
+      return p;
     }
+
+  default:
+    for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+    if (it->top == 0) { return NULL; }
+
+    p = it->stack[--it->top];
+    it->cur = p->right;
+    return p;
   }
+}
 
+//-------------------------------------------------------------------------
+void tree_iter_end(tree_iter* it) {
+  if (it->stack != it->small) { free(it->stack); }
+  it->stack = it->small;
+  it->top = 0;
 }
 
 //-------------------------------------------------------------------------
-bool tree_empty(tree* t) { return t->size == 0; }
+//a ranks above b: higher count, or the same count and alphabetically first
+static bool topk_above(tnode* a, tnode* b) {
+  return a->count > b->count || (a->count == b->count && strcmp(a->word, b->word) < 0);
+}
 
 //-------------------------------------------------------------------------
-size_t tree_size(tree* t) { return t->size; }
+static void topk_place(topk* h, int i, tnode* p) {
+  h->heap[i] = p;
+  p->heap_pos = i;
+}
+
+//-------------------------------------------------------------------------
+static void topk_siftup(topk* h, int i) {
+  tnode* p = h->heap[i];
+  while (i > 0 && topk_above(h->heap[(i - 1) / 2], p)) {
+    topk_place(h, i, h->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  topk_place(h, i, p);
+}
+
+//-------------------------------------------------------------------------
+static void topk_siftdown(topk* h, int i) {
+  tnode* p = h->heap[i];
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= h->len) { break; }
+    if (c + 1 < h->len && topk_above(h->heap[c], h->heap[c + 1])) { ++c; }
+    if (!topk_above(p, h->heap[c])) { break; }
+    topk_place(h, i, h->heap[c]);
+    i = c;
+  }
+  topk_place(h, i, p);
+}
+
+//-------------------------------------------------------------------------
+//called after p's count went up by one. Counts only grow, so a node outside
+//the heap can only get in by overtaking the weakest member: the heap stays
+//exactly the top K with O(log K) work per word.
+static void topk_update(topk* h, tnode* p) {
+  if (p->heap_pos >= 0) {
+    topk_siftdown(h, p->heap_pos);
+  } else if (h->len < h->k) {
+    h->heap[h->len] = p;
+    topk_siftup(h, h->len++);
+  } else if (topk_above(p, h->heap[0])) {
+    h->heap[0]->heap_pos = -1;
+    topk_place(h, 0, p);
+    topk_siftdown(h, 0);
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_topk_enable(tree* t, int k) {
+  t->top = (topk*)malloc(sizeof(topk));
+  t->top->heap = (tnode**)malloc(k * sizeof(tnode*));
+  t->top->len = 0;
+  t->top->k = k;
+}
+
+//-------------------------------------------------------------------------
+static int topk_cmp(const void* a, const void* b) {
+  tnode* p = *(tnode* const*)a;
+  tnode* q = *(tnode* const*)b;
+  return topk_above(p, q) ? -1 : topk_above(q, p) ? 1 : 0;
+}
+
+//-------------------------------------------------------------------------
+//copies the current top K into out, most frequent first; returns how many
+int tree_topk(tree* t, tnode** out) {
+  if (t->top == NULL) { return 0; }
+
+  uint64_t t0 = timing_start();
+  memcpy(out, t->top->heap, t->top->len * sizeof(tnode*));
+  qsort(out, t->top->len, sizeof(tnode*), topk_cmp);
+  timing_stop(PHASE_RANK, t0);
+  return t->top->len;
+}
+
+//-------------------------------------------------------------------------
+void tree_topk_delete(tree* t) {
+  if (t->top == NULL) { return; }
+
+  free(t->top->heap);
+  free(t->top);
+  t->top = NULL;
+}
 
 //-------------------------------------------------------------------------
 static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
@@ -85,8 +273,10 @@ static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
   if (*p == NULL) {
     *p = tnode_create(w);
     t->size++;
+    if (t->top != NULL) { topk_update(t->top, *p); }
   } else if ((compare = strcmp(w, (*p)->word)) == 0) {
     (*p)->count++;
+    if (t->top != NULL) { topk_update(t->top, *p); }
   } else if (compare < 0) { tree_addnode(t, &(*p)->left, w);
   } else {
     tree_addnode(t, &(*p)->right, w);
@@ -97,47 +287,51 @@ static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
 
 //-------------------------------------------------------------------------
 tnode* tree_add(tree* t, const char* word) {
+  uint64_t t0 = timing_start();
   tnode* p = tree_addnode(t, &(t->root), word);
+  timing_insert(t0);
   return p;
 }
 
 //-------------------------------------------------------------------------
-static tnode* tree_freq_addnode(tree* t, tnode** p, tnode* base_p) {
-  int compare;
-  if(*p == NULL) {
-    *p = tnode_create(base_p->word);
-    (*p)->count = base_p->count;
-    (*p)->left = NULL;
-    (*p)->right = NULL;
+//returns the tree's nodes ordered by count, highest first, with equal
+//counts kept alphabetical. The inorder walk yields them alphabetically and
+//a stable LSD radix sort on the count (one pass per significant byte)
+//does the rest in O(n); no word is compared or copied.
+tnode** tree_freq_rank(tree* t) {
+  uint64_t t0 = timing_start();
+  size_t n = t->size;
+  tnode** rank = (tnode**)malloc((n + 1) * sizeof(tnode*));
+  tnode** tmp = (tnode**)malloc((n + 1) * sizeof(tnode*));
+  tree_iter it;
+  tnode* p;
+  unsigned max = 0;
+  size_t k = 0;
+
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) {
+    rank[k++] = p;
+    if ((unsigned)p->count > max) { max = p->count; }
   }
-  else if ((compare = strcmp(base_p->word, (*p)->word)) < 0) {
-    tree_freq_addnode(t, &(*p)->left, base_p);
-  }
-  else if (compare > 0) {
-    tree_freq_addnode(t, &(*p)->right, base_p);
-  }
-
-  return *p;
-}
-
-//-------------------------------------------------------------------------
-static void tree_freq_node_fromtree(tree* tr[], tnode* base_node) {
-  if (base_node == NULL) { return; }
-  tree_freq_node_fromtree(tr, base_node->left);
-
-  int i = base_node->count;
-  tree** t = &tr[i];
+  tree_iter_end(&it);
 
-  if (*t == NULL && i != 0) {
-    *t = tree_create();
+  for (int shift = 0; shift < 32 && (max >> shift) != 0; shift += 8) {
+    size_t start[257] = {0};
+    for (size_t i = 0; i < n; ++i) {
+      start[255 - ((rank[i]->count >> shift) & 0xFF) + 1]++;   //descending
+    }
+    for (int b = 0; b < 256; ++b) { start[b + 1] += start[b]; }
+    for (size_t i = 0; i < n; ++i) {
+      tmp[start[255 - ((rank[i]->count >> shift) & 0xFF)]++] = rank[i];
+    }
+    tnode** swap = rank;
+    rank = tmp;
+    tmp = swap;
   }
-  tree_freq_addnode(*t, &(*t)->root, base_node);
-  tree_freq_node_fromtree(tr, base_node->right);
-}
 
-//-------------------------------------------------------------------------
-void tree_freq_fromtree(tree* tr[], tree* base_tree) {
-  tree_freq_node_fromtree(tr, base_tree->root);
+  free(tmp);
+  timing_stop(PHASE_RANK, t0);
+  return rank;
 }
 
 //-------------------------------------------------------------------------
@@ -165,24 +359,33 @@ void file_input(tree* t, const char* filename) {
   char line[BUFSIZ];
   memset(line, 0, BUFSIZ);
 
+  uint64_t t0 = timing_start();
   while (fgets(line, BUFSIZ, f) != NULL) {
+    t0 = timing_stop(PHASE_READ, t0);
     if (*line == '\n') { continue; }
     char* p = strtok(line, ",. !\n");
+    timing_stop(PHASE_TOKENIZE, t0);
     tree_add(t, p);
 
     while (p != NULL) {
+      t0 = timing_start();
       p = strtok(NULL, ",. !\n");
+      timing_stop(PHASE_TOKENIZE, t0);
       if (p == NULL) { continue; }
       tree_add(t, p);
     }
+    t0 = timing_start();
   }
+  timing_stop(PHASE_READ, t0);
 
   fclose(f);
 }
 
 //-------------------------------------------------------------------------
-tree* get_input(int argc, const char* argv[]) {
+//k > 0 keeps the k most frequent words up to date while reading
+tree* get_input(int argc, const char* argv[], int k) {
   tree* t = tree_create();
+  if (k > 0) { tree_topk_enable(t, k); }
 
   if (argc == 1) {
     fprintf(stderr, "Usage: ./program file/keyboard input\n");
@@ -202,9 +405,12 @@ tree* get_input(int argc, const char* argv[]) {
 
 //-------------------------------------------------------------------------
 void tree_clear(tree* t) {
+  uint64_t t0 = timing_start();
+  if (t->top != NULL) { t->top->len = 0; }
   tree_delete(t);
   t->root = NULL;
   t->size = 0;
+  timing_stop(PHASE_CLEAR, t0);
 }
 
 //-------------------------------------------------------------------------
@@ -213,73 +419,61 @@ void tree_print(tnode* p) {
 }
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_inorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
-
-  tree_printnodes_inorder(t, p->left);
-  tree_print(p);
-  tree_printnodes_inorder(t, p->right);
-}
-
-//-------------------------------------------------------------------------
-void tree_print_inorder(tree* t) {
-  tree_printnodes_inorder(t, t->root);
-}
-
-//-------------------------------------------------------------------------
-static void tree_printnodes_preorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
-
-  tree_print(p);
-  tree_printnodes_preorder(t, p->left);
-  tree_printnodes_preorder(t, p->right);
+static void tree_print_order(tree* t, int order) {
+  tree_iter it;
+  tnode* p;
+
+  uint64_t t0 = timing_start();
+  tree_iter_begin(&it, t, order);
+  while ((p = tree_iter_next(&it)) != NULL) { tree_print(p); }
+  tree_iter_end(&it);
+  timing_stop(PHASE_PRINT, t0);
 }
 
 //-------------------------------------------------------------------------
-void tree_print_preorder(tree* t) {
-  tree_printnodes_preorder(t, t->root);
-}
+void tree_print_inorder(tree* t) { tree_print_order(t, TREE_INORDER); }
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_postorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
-
-  tree_printnodes_postorder(t, p->left);
-  tree_printnodes_postorder(t, p->right);
-  tree_print(p);
-}
+void tree_print_preorder(tree* t) { tree_print_order(t, TREE_PREORDER); }
 
 //-------------------------------------------------------------------------
-void tree_print_postorder(tree* t) {
-  tree_printnodes_postorder(t, t->root);
-}
+void tree_print_postorder(tree* t) { tree_print_order(t, TREE_POSTORDER); }
 
 //-------------------------------------------------------------------------
-void tree_freq_print(tree* tr[]) {
-  for (int i = MAX_FREQ - 1; i >= 1; --i) {
-    tree* t = tr[i];
-    if (t != NULL && t->root != NULL) {
-      tree_print_inorder(t);
-    }
+void tree_freq_print(tnode** rank, size_t n) {
+  uint64_t t0 = timing_start();
+  for (size_t i = 0; i < n; ++i) {
+    tree_print(rank[i]);
   }
+  timing_stop(PHASE_PRINT, t0);
 }
 
 //-------------------------------------------------------------------------
+//./program [-k K] file/keyboard input; -k prints only the K most frequent
 int main(int argc, const char* argv[]) {
+  int k = 0;
+  if (argc > 2 && strcmp(argv[1], "-k") == 0) {
+    k = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
 
-  tree* t = get_input(argc, argv);
-
-  tree* trees[MAX_FREQ];
-  memset(trees, 0, MAX_FREQ * sizeof(tree*));
-
-  tree_freq_fromtree(trees, t);
+  tree* t = get_input(argc, argv, k);
 
-  tree_freq_print(trees);
-  tree_freq_delete(trees);
+  if (k > 0) {
+    tnode** top = (tnode**)malloc(k * sizeof(tnode*));
+    int n = tree_topk(t, top);
+    tree_freq_print(top, n);
+    free(top);
+  } else {
+    tnode** rank = tree_freq_rank(t);
+    tree_freq_print(rank, tree_size(t));
+    free(rank);
+  }
 
   tree_clear(t);
+  tree_topk_delete(t);
   free(t);
-  free(*trees);
 
   return 0;
 }
@@ -10,5 +10,27 @@ int main(int argc, const char* argv[]) {
 
   tree_test_hardcode();
 
+  tree_test_balanced();
+
+  tree_test_parallel(argc, argv);
+
+  tree_test_concurrent();
+
+  tree_test_scanners();
+
+  tree_test_hash(argc, argv);
+
+  tree_test_btree(argc, argv);
+
+  tree_test_snapshot(argc, argv);
+
+  tree_test_bulkload();
+
+  tree_test_lookup();
+
+  tree_test_stats();
+
+  tree_test_bounds();
+
   return 0;
 }
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef TIMING_H
+#define TIMING_H
+
+
+//-------------------------------------------------------------------------
+//Optional per-phase timing for the word-count programs, switched on by the
+//TREE_TIMING environment variable: "1" reports to stderr at exit, any other
+//value is a file the report is written to as JSON. While it is unset every
+//hook is a single branch on a cached flag.
+//
+//Header-only: each file that includes it keeps its own totals, so include
+//it from the file that runs the pipeline. Counters are updated atomically,
+//so ingest threads may record concurrently.
+
+//-------------------------------------------------------------------------
+enum timing_phase {
+  PHASE_READ,       //fgets, mmap
+  PHASE_TOKENIZE,   //finding word boundaries
+  PHASE_INSERT,     //tree_add, one histogram sample per call
+  PHASE_MERGE,      //combining per-thread trees
+  PHASE_RANK,       //frequency ordering
+  PHASE_PRINT,
+  PHASE_CLEAR,
+  PHASE_COUNT
+};
+
+static const char* timing_names[PHASE_COUNT] = {
+  "read", "tokenize", "insert", "merge", "rank", "print", "clear",
+};
+
+//-------------------------------------------------------------------------
+//insert latencies in ns: exact below 8, then 8 buckets per power of two,
+//so a percentile read from the histogram is within 12.5%
+#define TIMING_SUB 8
+#define TIMING_BUCKETS ((64 - 2) * TIMING_SUB)
+
+typedef struct timing timing;
+struct timing {
+  int enabled;       //-1 until TREE_TIMING has been looked at
+  const char* target;
+  uint64_t total[PHASE_COUNT];   //ns
+  uint64_t calls[PHASE_COUNT];
+  uint64_t max_insert;
+  uint64_t hist[TIMING_BUCKETS];
+};
+
+static timing timings = {.enabled = -1};
+
+static void timing_report(void);
+
+//-------------------------------------------------------------------------
+static inline uint64_t timing_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+//-------------------------------------------------------------------------
+static bool timing_init() {
+  const char* target = getenv("TREE_TIMING");
+  bool on = target != NULL && *target != '\0' && strcmp(target, "0") != 0;
+
+  timings.target = on && strcmp(target, "1") != 0 ? target : NULL;
+  int unset = -1;   //only the first caller registers the report
+  if (__atomic_compare_exchange_n(&timings.enabled, &unset, on, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && on) {
+    atexit(timing_report);
+  }
+  return __atomic_load_n(&timings.enabled, __ATOMIC_ACQUIRE) == 1;
+}
+
+//-------------------------------------------------------------------------
+//start of a timed span, 0 when timing is off
+static inline uint64_t timing_start() {
+  int on = __atomic_load_n(&timings.enabled, __ATOMIC_ACQUIRE);
+  if (on == 0) { return 0; }
+  if (on < 0 && !timing_init()) { return 0; }
+  return timing_now();
+}
+
+//-------------------------------------------------------------------------
+//charges the span since t0 to phase; returns the current time (0 when off)
+//so back-to-back phases can share one clock read
+static inline uint64_t timing_stop(int phase, uint64_t t0) {
+  if (t0 == 0) { return 0; }
+
+  uint64_t now = timing_now();
+  __atomic_fetch_add(&timings.total[phase], now - t0, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&timings.calls[phase], 1, __ATOMIC_RELAXED);
+  return now;
+}
+
+//-------------------------------------------------------------------------
+static inline size_t timing_bucket(uint64_t ns) {
+  if (ns < TIMING_SUB) { return ns; }
+
+  int b = 63 - __builtin_clzll(ns);   //b >= 3
+  return (b - 2) * TIMING_SUB + ((ns >> (b - 3)) & (TIMING_SUB - 1));
+}
+
+//-------------------------------------------------------------------------
+//largest latency that falls in bucket i
+static uint64_t timing_bucket_max(size_t i) {
+  if (i < TIMING_SUB) { return i; }
+
+  int b = i / TIMING_SUB + 2;
+  uint64_t lo = (uint64_t)(TIMING_SUB + i % TIMING_SUB) << (b - 3);
+  return lo + ((uint64_t)1 << (b - 3)) - 1;
+}
+
+//-------------------------------------------------------------------------
+//ends an insert started at t0 and records its latency
+static inline uint64_t timing_insert(uint64_t t0) {
+  if (t0 == 0) { return 0; }
+
+  uint64_t now = timing_stop(PHASE_INSERT, t0);
+  uint64_t ns = now - t0;
+  __atomic_fetch_add(&timings.hist[timing_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&timings.max_insert, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&timings.max_insert, &max, ns, true,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+  return now;
+}
+
+//-------------------------------------------------------------------------
+//upper bound of the q-th fraction of insert latencies
+static uint64_t timing_percentile(double q) {
+  uint64_t n = timings.calls[PHASE_INSERT], seen = 0;
+  uint64_t want = (uint64_t)(q * n);
+  if (want == 0) { want = 1; }
+
+  for (size_t i = 0; i < TIMING_BUCKETS; ++i) {
+    seen += timings.hist[i];
+    if (seen >= want) { return timing_bucket_max(i); }
+  }
+  return timings.max_insert;
+}
+
+//-------------------------------------------------------------------------
+static void timing_report(void) {
+  uint64_t n = timings.calls[PHASE_INSERT];
+  uint64_t p50 = timing_percentile(0.5), p99 = timing_percentile(0.99);
+  uint64_t p999 = timing_percentile(0.999);
+
+  if (timings.target == NULL) {
+    fprintf(stderr, "%-10s %12s %12s\n", "phase", "calls", "ms");
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+      if (timings.calls[i] == 0) { continue; }
+      fprintf(stderr, "%-10s %12llu %12.3f\n", timing_names[i],
+              (unsigned long long)timings.calls[i], timings.total[i] / 1e6);
+    }
+    if (n > 0) {
+      fprintf(stderr, "insert ns: p50 %llu, p99 %llu, p999 %llu, max %llu\n",
+              (unsigned long long)p50, (unsigned long long)p99,
+              (unsigned long long)p999, (unsigned long long)timings.max_insert);
+    }
+    return;
+  }
+
+  FILE* f = fopen(timings.target, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Error opening file: %s\n", timings.target);
+    return;
+  }
+  fprintf(f, "{\n  \"phases\": {");
+  const char* sep = "";
+  for (int i = 0; i < PHASE_COUNT; ++i) {
+    if (timings.calls[i] == 0) { continue; }
+    fprintf(f, "%s\n    \"%s\": {\"calls\": %llu, \"ns\": %llu}", sep, timing_names[i],
+            (unsigned long long)timings.calls[i], (unsigned long long)timings.total[i]);
+    sep = ",";
+  }
+  fprintf(f, "\n  },\n  \"insert_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+          (unsigned long long)p50, (unsigned long long)p99,
+          (unsigned long long)p999, (unsigned long long)timings.max_insert);
+  fprintf(f, "  \"insert_histogram\": [");
+  sep = "";
+  for (size_t i = 0; i < TIMING_BUCKETS; ++i) {   //[bucket max ns, inserts]
+    if (timings.hist[i] == 0) { continue; }
+    fprintf(f, "%s[%llu, %llu]", sep, (unsigned long long)timing_bucket_max(i),
+            (unsigned long long)timings.hist[i]);
+    sep = ", ";
+  }
+  fprintf(f, "]\n}\n");
+  fclose(f);
+}
+
+#endif
@@ -2,10 +2,32 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "tree.h"
+#include "timing.h"
 
 //-------------------------------------------------------------------------
-tree* get_input(int argc, const char* argv[]) {
+//hot-path counters for tree_stats; without -DTREE_STATS they compile away.
+//Relaxed atomic adds, so TREE_CONCURRENT producers count exactly too.
+#ifdef TREE_STATS
+#define TREE_COUNT(t, field, n) __atomic_fetch_add(&(t)->ops.field, (n), __ATOMIC_RELAXED)
+#else
+#define TREE_COUNT(t, field, n) ((void)0)
+#endif
+
+//TREE_HASH: builds the sorted tree from the table before ordered access
+static void tree_sort(tree* t);
+
+//-------------------------------------------------------------------------
+//nthreads > 1 splits file input across that many ingest threads
+tree* get_input(int argc, const char* argv[], int nthreads) {
   tree* t = tree_create();
 
   if (argc == 1) {
@@ -15,7 +37,7 @@ tree* get_input(int argc, const char* argv[]) {
 
   if (argc == 2) {
     const char* filename = argv[1];
-    file_input(t, filename);
+    file_input_parallel(t, filename, nthreads);
   }
 
   if (argc > 2) {
@@ -24,51 +46,443 @@ tree* get_input(int argc, const char* argv[]) {
   return t;
 }
 
+//-------------------------------------------------------------------------
+//word delimiters: a byte table for the scalar scanner plus the same set as
+//a short list that the SSE2/AVX2 scanners compare 16 or 32 bytes against.
+//NUL is always a delimiter so a word view never holds one.
+#define DELIM_SIMD_MAX 16
+
+static bool delim_table[256] = {
+  ['\0'] = true, [','] = true, ['.'] = true, [' '] = true, ['!'] = true, ['\n'] = true
+};
+static char delim_chars[DELIM_SIMD_MAX] = {'\0', ',', '.', ' ', '!', '\n'};
+static int delim_count = 6;
+
+typedef const char* (*scan_fn)(const char* p, const char* end, bool want);
+static scan_fn scan_chosen = NULL;   //picked on first use from the CPU features
+
+//-------------------------------------------------------------------------
+void tree_set_delims(const char* set) {
+  memset(delim_table, 0, sizeof(delim_table));
+  delim_table[0] = true;
+  delim_chars[0] = '\0';
+  delim_count = 1;
+  for (const char* s = set; *s != '\0'; ++s) {
+    unsigned char c = (unsigned char)*s;
+    if (delim_table[c]) { continue; }
+    delim_table[c] = true;
+    if (delim_count < DELIM_SIMD_MAX) { delim_chars[delim_count] = *s; }
+    ++delim_count;
+  }
+  scan_chosen = NULL;
+}
+
+//-------------------------------------------------------------------------
+static bool is_delim(char c) { return delim_table[(unsigned char)c]; }
+
+//-------------------------------------------------------------------------
+//scanners return the first byte in [p, end) that is (or is not) a delimiter
+static const char* scan_delim_scalar(const char* p, const char* end, bool want) {
+  while (p < end && is_delim(*p) != want) { ++p; }
+  return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//-------------------------------------------------------------------------
+__attribute__((target("sse2")))
+static const char* scan_delim_sse2(const char* p, const char* end, bool want) {
+  __m128i set[DELIM_SIMD_MAX];
+  for (int i = 0; i < delim_count; ++i) { set[i] = _mm_set1_epi8(delim_chars[i]); }
+  unsigned flip = want ? 0 : 0xFFFF;
+
+  for ( ; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_setzero_si128();
+    for (int i = 0; i < delim_count; ++i) { m = _mm_or_si128(m, _mm_cmpeq_epi8(v, set[i])); }
+    unsigned mask = (unsigned)_mm_movemask_epi8(m) ^ flip;
+    if (mask != 0) { return p + __builtin_ctz(mask); }
+  }
+  return scan_delim_scalar(p, end, want);
+}
+
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static const char* scan_delim_avx2(const char* p, const char* end, bool want) {
+  __m256i set[DELIM_SIMD_MAX];
+  for (int i = 0; i < delim_count; ++i) { set[i] = _mm256_set1_epi8(delim_chars[i]); }
+  unsigned flip = want ? 0 : 0xFFFFFFFFu;
+
+  for ( ; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i m = _mm256_setzero_si256();
+    for (int i = 0; i < delim_count; ++i) { m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, set[i])); }
+    unsigned mask = (unsigned)_mm256_movemask_epi8(m) ^ flip;
+    if (mask != 0) { return p + __builtin_ctz(mask); }
+  }
+  return scan_delim_sse2(p, end, want);
+}
+#endif
+
+//-------------------------------------------------------------------------
+static scan_fn scan_select() {
+  if (scan_chosen != NULL) { return scan_chosen; }
+
+  scan_chosen = scan_delim_scalar;
+  if (delim_count > DELIM_SIMD_MAX) { return scan_chosen; }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) { scan_chosen = scan_delim_avx2; }
+  else if (__builtin_cpu_supports("sse2")) { scan_chosen = scan_delim_sse2; }
+#endif
+  return scan_chosen;
+}
+
+//-------------------------------------------------------------------------
+//forces one scanner until the next tree_set_delims; false, leaving the
+//choice alone, if the CPU lacks it or the delimiter set is too large for it
+bool tree_set_scanner(int scanner) {
+  if (scanner == TREE_SCAN_AUTO) {
+    scan_chosen = NULL;
+    return true;
+  }
+  if (scanner == TREE_SCAN_SCALAR) {
+    scan_chosen = scan_delim_scalar;
+    return true;
+  }
+  if (delim_count > DELIM_SIMD_MAX) { return false; }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (scanner == TREE_SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+    scan_chosen = scan_delim_sse2;
+    return true;
+  }
+  if (scanner == TREE_SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+    scan_chosen = scan_delim_avx2;
+    return true;
+  }
+#endif
+  return false;
+}
+
+//-------------------------------------------------------------------------
+//returns the start of the next word in [p, end) and its length in *len,
+//or NULL when only delimiters remain
+const char* token_next(const char* p, const char* end, size_t* len) {
+  scan_fn scan = scan_select();
+  const char* w = scan(p, end, false);
+  if (w == end) { return NULL; }
+
+  const char* q = scan(w, end, true);
+  *len = q - w;
+  return w;
+}
+
+//-------------------------------------------------------------------------
+void tree_addtokens(tree* t, const char* p, const char* end) {
+  scan_fn scan = scan_select();
+
+  while (p < end) {
+    uint64_t t0 = timing_start();
+    const char* w = scan(p, end, false);
+    if (w == end) {
+      timing_stop(PHASE_TOKENIZE, t0);
+      break;
+    }
+    p = scan(w, end, true);
+    timing_stop(PHASE_TOKENIZE, t0);
+    tree_addn(t, w, p - w);
+  }
+}
+
 //-------------------------------------------------------------------------
 void console_input(tree* t, int argc, const char* argv[]) {
-  int i = 1;
-  char* p = strtok((char*)argv[i++], ",. !");
-  tree_add(t, p);
+  for (int i = 1; i < argc; ++i) {
+    tree_addtokens(t, argv[i], argv[i] + strlen(argv[i]));
+  }
+}
 
-  while (p != NULL && i < argc) {
-    p = strtok((char*)argv[i], ", .!");
-    tree_add(t, p);
-    ++i;
+//-------------------------------------------------------------------------
+static void carry_append(char** carry, size_t* len, size_t* cap, const char* p, size_t n) {
+  if (n == 0) { return; }
+  if (*len + n > *cap) {
+    *cap = (*len + n) * 2;
+    *carry = (char*)realloc(*carry, *cap);
   }
+  memcpy(*carry + *len, p, n);
+  *len += n;
 }
 
 //-------------------------------------------------------------------------
+//a line longer than BUFSIZ comes in several reads; a word cut off by the
+//end of one read is held in carry until the next read completes it
 void file_input(tree* t, const char* filename) {
   FILE* f = fopen(filename, "r");
   if (f == NULL) {
     fprintf(stderr, "Error opening file: %s\n", filename);
-    fclose(f);
     exit(1);
   }
 
   char line[BUFSIZ];
   memset(line, 0, BUFSIZ);
+  char* carry = NULL;
+  size_t carried = 0, cap = 0;
 
+  uint64_t t0 = timing_start();
   while (fgets(line, BUFSIZ, f) != NULL) {
-    if (*line == '\n') { continue; }
-    char* p = strtok(line, ",. !\n");
-    tree_add(t, p);
+    timing_stop(PHASE_READ, t0);
+    const char* p = line;
+    const char* end = line + strlen(line);
 
-    while (p != NULL) {
-      p = strtok(NULL, ",. !\n");
-      if (p == NULL) { continue; }
-      tree_add(t, p);
+    if (carried > 0) {
+      const char* q = p;
+      while (q < end && !is_delim(*q)) { ++q; }
+      carry_append(&carry, &carried, &cap, p, q - p);
+      p = q;
+      if (q < end) {
+        tree_addn(t, carry, carried);
+        carried = 0;
+      }
     }
+
+    const char* cut = end;
+    if (end - line == BUFSIZ - 1 && end[-1] != '\n') {
+      while (cut > p && !is_delim(cut[-1])) { --cut; }
+    }
+    tree_addtokens(t, p, cut);
+    carry_append(&carry, &carried, &cap, cut, end - cut);
+    t0 = timing_start();
   }
+  timing_stop(PHASE_READ, t0);
+  if (carried > 0) { tree_addn(t, carry, carried); }
 
+  free(carry);
   fclose(f);
 }
 
+//-------------------------------------------------------------------------
+//maps filename read-only, or copy-on-write when writable so callers can
+//cut it up in place; *size is 0 (and NULL returned) for an empty file
+static const char* file_map(const char* filename, size_t* size, bool writable) {
+  uint64_t t0 = timing_start();
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Error opening file: %s\n", filename);
+    exit(1);
+  }
+  *size = st.st_size;
+  if (st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  const char* base = (const char*)mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Error mapping file: %s\n", filename);
+    exit(1);
+  }
+  close(fd);
+  madvise((void*)base, st.st_size, MADV_SEQUENTIAL);
+  timing_stop(PHASE_READ, t0);
+  return base;
+}
+
+//-------------------------------------------------------------------------
+//maps the whole file and hands word views to the tree, so only words not
+//yet in the tree are copied and long lines are never split
+void file_input_mmap(tree* t, const char* filename) {
+  size_t size;
+  const char* base = file_map(filename, &size, false);
+  if (base == NULL) { return; }
+
+  tree_addtokens(t, base, base + size);
+
+  munmap((void*)base, size);
+}
+
+//-------------------------------------------------------------------------
+typedef struct ingest_chunk ingest_chunk;
+struct ingest_chunk {
+  const char* begin;
+  const char* end;
+  tree* t;
+};
+
+//-------------------------------------------------------------------------
+static void* ingest_worker(void* arg) {
+  ingest_chunk* c = (ingest_chunk*)arg;
+  tree_addtokens(c->t, c->begin, c->end);
+  return NULL;
+}
+
+//-------------------------------------------------------------------------
+//moves p forward to the delimiter ending its line, so no word is split
+static const char* chunk_boundary(const char* p, const char* end) {
+  const char* q = (const char*)memchr(p, '\n', end - p);
+  if (q == NULL) { return end; }
+  return scan_select()(q, end, true);   //q itself unless '\n' was removed
+}
+
+//-------------------------------------------------------------------------
+//splits the mapped file into newline-aligned chunks, counts each chunk into
+//a private AVL/arena tree on its own thread, then merges them into t. A
+//TREE_CONCURRENT t is shared by the threads instead and needs no merge.
+void file_input_parallel(tree* t, const char* filename, int nthreads) {
+  if (nthreads <= 1) {
+    file_input_mmap(t, filename);
+    return;
+  }
+
+  size_t size;
+  const char* base = file_map(filename, &size, false);
+  if (base == NULL) { return; }
+  const char* end = base + size;
+
+  scan_select();   //pick the scanner before the workers race to do it
+  ingest_chunk* chunks = (ingest_chunk*)malloc(nthreads * sizeof(ingest_chunk));
+  pthread_t* threads = (pthread_t*)malloc(nthreads * sizeof(pthread_t));
+
+  const char* p = base;
+  for (int i = 0; i < nthreads; ++i) {
+    const char* q = i == nthreads - 1 ? end : base + size / nthreads * (i + 1);
+    if (q < p) { q = p; }
+    q = chunk_boundary(q, end);
+    chunks[i].begin = p;
+    chunks[i].end = q;
+    chunks[i].t = t->mode & TREE_CONCURRENT ? t : tree_create_mode(TREE_AVL | TREE_ARENA);
+    p = q;
+  }
+
+  for (int i = 0; i < nthreads; ++i) {
+    if (pthread_create(&threads[i], NULL, ingest_worker, &chunks[i]) != 0) {
+      fprintf(stderr, "Error creating ingest thread\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < nthreads; ++i) {
+    pthread_join(threads[i], NULL);
+    if (chunks[i].t == t) { continue; }   //TREE_CONCURRENT: added in place
+    if (i > 0) {
+      tree_merge(chunks[0].t, chunks[i].t);   //arena to arena: no copies
+      free(chunks[i].t);
+    }
+  }
+  if (chunks[0].t != t) {
+    tree_merge(t, chunks[0].t);
+    free(chunks[0].t);
+  }
+
+  free(threads);
+  free(chunks);
+  munmap((void*)base, size);
+}
+
+//-------------------------------------------------------------------------
+//reloads counted words, one per line as written by tree_write in any
+//format ("word count", "word<TAB>count" or "word -- count  (...)");
+//lines without a count are skipped
+void file_input_counts(tree* t, const char* filename) {
+  size_t size;
+  char* base = (char*)file_map(filename, &size, true);
+  if (base == NULL) { return; }
+  char* end = base + size;
+
+  size_t n = 0, cap = 1024;
+  tree_pair* pairs = (tree_pair*)malloc(cap * sizeof(tree_pair));
+
+  for (char* p = base; p < end; ) {
+    char* eol = (char*)memchr(p, '\n', end - p);
+    if (eol == NULL) { eol = end; }
+
+    char* q = p;
+    while (q < eol && *q != ' ' && *q != '\t') { ++q; }
+    char* word_end = q;
+    while (q < eol && (*q == ' ' || *q == '\t' || *q == '-')) { ++q; }
+
+    long count = 0;
+    bool digits = false;
+    for ( ; q < eol && *q >= '0' && *q <= '9'; ++q) {
+      count = count * 10 + (*q - '0');
+      digits = true;
+    }
+
+    if (digits && word_end > p && word_end < eol) {
+      *word_end = '\0';   //private mapping, the file is untouched
+      if (n == cap) {
+        cap *= 2;
+        pairs = (tree_pair*)realloc(pairs, cap * sizeof(tree_pair));
+      }
+      pairs[n].word = p;
+      pairs[n].count = (int)count;
+      ++n;
+    }
+    p = eol + 1;
+  }
+
+  tree_build_sorted(t, pairs, n);
+  free(pairs);
+  munmap(base, size);
+}
+
+//-------------------------------------------------------------------------
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+//-------------------------------------------------------------------------
+void* arena_alloc(arena* a, size_t n, size_t align) {
+  arena_block* b = a->head;
+  size_t off = 0;
+
+  if (b != NULL) { off = (b->used + align - 1) & ~(align - 1); }
+  if (b == NULL || off + n > b->size) {
+    size_t size = n + align > ARENA_BLOCK_SIZE ? n + align : ARENA_BLOCK_SIZE;
+    b = (arena_block*)malloc(sizeof(arena_block) + size);
+    if (b == NULL) {
+      fprintf(stderr, "Out of memory allocating tree arena\n");
+      exit(1);
+    }
+    b->next = a->head;
+    b->size = size;
+    b->used = 0;
+    a->head = b;
+    a->reserved += sizeof(arena_block) + size;
+    off = 0;
+  }
+
+  b->used = off + n;
+  a->used += n;
+  return b->data + off;
+}
+
+//-------------------------------------------------------------------------
+char* arena_strdup(arena* a, const char* s, size_t len) {
+  char* p = (char*)arena_alloc(a, len + 1, 1);
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+//-------------------------------------------------------------------------
+void arena_release(arena* a) {
+  arena_block* b = a->head;
+  while (b != NULL) {
+    arena_block* q = b;
+    b = b->next;
+    free(q);
+  }
+  a->head = NULL;
+  a->reserved = 0;
+  a->used = 0;
+}
+
 //-------------------------------------------------------------------------
 tnode* tnode_create(const char* word) {
   tnode* p = (tnode*)malloc(sizeof(tnode));
   p->word = strdup(word);   //copy of word allocated on heap
   p->count = 1;
+  p->height = 1;
   p->left = NULL;
   p->right = NULL;
   return p;
@@ -81,25 +495,98 @@ void tnode_delete(tnode* t) {
 }
 
 //-------------------------------------------------------------------------
-tree* tree_create() {
+tree* tree_create() { return tree_create_mode(TREE_PLAIN); }
+
+//-------------------------------------------------------------------------
+tree* tree_create_mode(int mode) {
+  if ((mode & TREE_CONCURRENT) && mode != TREE_CONCURRENT) {   //no rotations, arena or table
+    fprintf(stderr, "TREE_CONCURRENT cannot be combined with other modes\n");
+    exit(1);
+  }
+
   tree* p = (tree*)malloc(sizeof(tree));
   p->root = NULL;
   p->size = 0;
+  p->mode = mode;
+  p->pool.head = NULL;
+  p->pool.reserved = 0;
+  p->pool.used = 0;
+  p->table = NULL;
+  p->table_cap = 0;
+  p->sorted = true;
+  memset(&p->ops, 0, sizeof(p->ops));
   return p;
 }
 
 //-------------------------------------------------------------------------
-static void tree_deletenodes(tree* t, tnode* p) {
-  if ( p == NULL) { return; }
+//copies only the len bytes of w, which need not be NUL-terminated
+static tnode* tree_newnode(tree* t, const char* w, size_t len) {
+  tnode* p;
+
+  if (t->mode & TREE_ARENA) {
+    size_t reserved = t->pool.reserved;
+    p = (tnode*)arena_alloc(&t->pool, sizeof(tnode), sizeof(void*));
+    p->word = arena_strdup(&t->pool, w, len);
+    TREE_COUNT(t, allocs, t->pool.reserved != reserved);
+    (void)reserved;
+  } else {
+    char* s = (char*)malloc(len + 1);
+    memcpy(s, w, len);
+    s[len] = '\0';
+    p = (tnode*)malloc(sizeof(tnode));
+    p->word = s;
+    TREE_COUNT(t, allocs, 2);
+  }
+  p->count = 1;
+  p->height = 1;
+  p->left = NULL;
+  p->right = NULL;
+  return p;
+}
 
-  tree_deletenodes(t, p->left);
-  tree_deletenodes(t, p->right);
-  tnode_delete(p);
-  t->size--;
+//-------------------------------------------------------------------------
+//rotates each left child up until the node has none, then frees it, so the
+//teardown needs neither recursion nor a stack
+static void tree_deletenodes(tree* t, tnode* p) {
+  while (p != NULL) {
+    tnode* q;
+    if (p->left != NULL) {
+      q = p->left;
+      p->left = q->right;
+      q->right = p;
+    } else {
+      q = p->right;
+      tnode_delete(p);
+      t->size--;
+    }
+    p = q;
+  }
 }
 
 //-------------------------------------------------------------------------
-void tree_delete(tree* t) { tree_deletenodes(t, t->root); }
+void tree_delete(tree* t) {
+  if (t->mode & TREE_HASH) {
+    if (!(t->mode & TREE_ARENA)) {   //root may be stale, the table is not
+      for (size_t i = 0; i < t->table_cap; ++i) {
+        if (t->table[i].node != NULL) { tnode_delete(t->table[i].node); }
+      }
+    }
+    free(t->table);
+    t->table = NULL;
+    t->table_cap = 0;
+    t->sorted = true;
+  }
+  if (t->mode & TREE_ARENA) {
+    arena_release(&t->pool);
+    t->size = 0;
+    return;
+  }
+  if (t->mode & TREE_HASH) {
+    t->size = 0;
+    return;
+  }
+  tree_deletenodes(t, t->root);
+}
 
 //-------------------------------------------------------------------------
 bool tree_empty(tree* t) { return t->size == 0; }
@@ -108,78 +595,1282 @@ bool tree_empty(tree* t) { return t->size == 0; }
 size_t tree_size(tree* t) { return t->size; }
 
 //-------------------------------------------------------------------------
-static tnode* tree_addnode(tree* t, tnode** p, const char* w) {
+//strcmp of the word view w[0..len) against the NUL-terminated s; never
+//reads past the end of s, even if the view holds a NUL
+static int wordcmp(const char* w, size_t len, const char* s) {
+  size_t n = strnlen(s, len);
+  int compare = memcmp(w, s, n);
+  if (compare != 0) { return compare; }
+  if (n < len) { return 1; }
+  return s[len] == '\0' ? 0 : -1;
+}
+
+//-------------------------------------------------------------------------
+static void tree_iter_push(tree_iter* it, tnode* p) {
+  if (it->top == it->cap) {
+    size_t cap = it->cap * 2;
+    tnode** stack = (tnode**)malloc(cap * sizeof(tnode*));
+    memcpy(stack, it->stack, it->top * sizeof(tnode*));
+    if (it->stack != it->small) { free(it->stack); }
+    it->stack = stack;
+    it->cap = cap;
+  }
+  it->stack[it->top++] = p;
+}
+
+//-------------------------------------------------------------------------
+void tree_iter_begin(tree_iter* it, tree* t, int order) {
+  tree_sort(t);
+  it->stack = it->small;
+  it->top = 0;
+  it->cap = TREE_ITER_SMALL;
+  it->order = order;
+  it->cur = t->root;
+  it->last = NULL;
+  it->t = t;
+
+  if (order == TREE_PREORDER) {
+    if (t->root != NULL) { tree_iter_push(it, t->root); }
+    it->cur = NULL;
+  }
+}
+
+//-------------------------------------------------------------------------
+tnode* tree_iter_next(tree_iter* it) {
+  tnode* p;
+
+  switch (it->order) {
+  case TREE_PREORDER:
+    if (it->top == 0) { return NULL; }
+    p = it->stack[--it->top];
+    if (p->right != NULL) { tree_iter_push(it, p->right); }
+    if (p->left != NULL) { tree_iter_push(it, p->left); }
+    return p;
+
+  case TREE_POSTORDER:
+    for (;;) {
+      for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+      if (it->top == 0) { return NULL; }
+
+      p = it->stack[it->top - 1];
+      if (p->right != NULL && p->right != it->last) {
+        it->cur = p->right;
+        continue;
+      }
+      --it->top;
+      it->last = p;
+      return p;
+    }
+
+  default:
+    for ( ; it->cur != NULL; it->cur = it->cur->left) { tree_iter_push(it, it->cur); }
+    if (it->top == 0) { return NULL; }
+
+    p = it->stack[--it->top];
+    it->cur = p->right;
+    return p;
+  }
+}
+
+//-------------------------------------------------------------------------
+//repositions an inorder iterator so the next node returned is the first
+//whose word is >= word[0..len)
+void tree_iter_seek(tree_iter* it, const char* word, size_t len) {
+  tnode* p = it->t->root;
+  it->top = 0;
+  it->cur = NULL;
+
+  while (p != NULL) {
+    if (wordcmp(word, len, p->word) <= 0) {
+      tree_iter_push(it, p);
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_iter_end(tree_iter* it) {
+  if (it->stack != it->small) { free(it->stack); }
+  it->stack = it->small;
+  it->top = 0;
+}
+
+//-------------------------------------------------------------------------
+static size_t tree_nodebytes(tree* t) {
+  size_t bytes = 0;
+  tree_iter it;
+  tnode* p;
+
+  tree_iter_begin(&it, t, TREE_PREORDER);
+  while ((p = tree_iter_next(&it)) != NULL) {
+    bytes += sizeof(tnode) + strlen(p->word) + 1;
+  }
+  tree_iter_end(&it);
+  return bytes;
+}
+
+//-------------------------------------------------------------------------
+//arena trees report block bytes vs bytes handed out; malloc'd trees
+//report the payload of every node and word for both
+void tree_memory(tree* t, size_t* reserved, size_t* used) {
+  if (t->mode & TREE_ARENA) {
+    *reserved = t->pool.reserved;
+    *used = t->pool.used;
+  } else {
+    *reserved = *used = tree_nodebytes(t);
+  }
+  *reserved += t->table_cap * sizeof(tslot);   //TREE_HASH index
+}
+
+//-------------------------------------------------------------------------
+static int tnode_height(tnode* p) { return p == NULL ? 0 : p->height; }
+
+//-------------------------------------------------------------------------
+static void tnode_update(tnode* p) {
+  int l = tnode_height(p->left);
+  int r = tnode_height(p->right);
+  p->height = 1 + (l > r ? l : r);
+}
+
+//-------------------------------------------------------------------------
+static tnode* tnode_rotate_right(tnode* p) {
+  tnode* q = p->left;
+  p->left = q->right;
+  q->right = p;
+  tnode_update(p);
+  tnode_update(q);
+  return q;
+}
+
+//-------------------------------------------------------------------------
+static tnode* tnode_rotate_left(tnode* p) {
+  tnode* q = p->right;
+  p->right = q->left;
+  q->left = p;
+  tnode_update(p);
+  tnode_update(q);
+  return q;
+}
+
+//-------------------------------------------------------------------------
+static tnode* tnode_rebalance(tnode* p) {
+  tnode_update(p);
+  int balance = tnode_height(p->left) - tnode_height(p->right);
+
+  if (balance > 1) {
+    if (tnode_height(p->left->left) < tnode_height(p->left->right)) {
+      p->left = tnode_rotate_left(p->left);
+    }
+    return tnode_rotate_right(p);
+  }
+  if (balance < -1) {
+    if (tnode_height(p->right->right) < tnode_height(p->right->left)) {
+      p->right = tnode_rotate_right(p->right);
+    }
+    return tnode_rotate_left(p);
+  }
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//returns the node holding w; in TREE_AVL mode *p is rebalanced on the way up
+static tnode* tree_addnode(tree* t, tnode** p, const char* w, size_t len, int n) {
   int compare;
+  tnode* q;
 
   if (*p == NULL) {
-    *p = tnode_create(w);
+    *p = tree_newnode(t, w, len);
+    (*p)->count = n;
     t->size++;
-  } else if ((compare = strcmp(w, (*p)->word)) == 0) {
-    (*p)->count++;
-  } else if (compare < 0) { tree_addnode(t, &(*p)->left, w);
+    return *p;
+  }
+  TREE_COUNT(t, compares, 1);
+  if ((compare = wordcmp(w, len, (*p)->word)) == 0) {
+    (*p)->count += n;
+    return *p;
+  } else if (compare < 0) { q = tree_addnode(t, &(*p)->left, w, len, n);
   } else {
-    tree_addnode(t, &(*p)->right, w);
+    q = tree_addnode(t, &(*p)->right, w, len, n);
   }
 
-  return *p;
+  if (t->mode & TREE_AVL) { *p = tnode_rebalance(*p); }
+  return q;
 }
 
 //-------------------------------------------------------------------------
-tnode* tree_add(tree* t, const char* word) {
-  tnode* p = tree_addnode(t, &(t->root), word);
-  return p;
+//FNV-1a over the word bytes
+static uint64_t tree_hash(const char* w, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)w[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
 }
 
 //-------------------------------------------------------------------------
-void tree_clear(tree* t) {
-  tree_delete(t);
-  t->root = NULL;
-  t->size = 0;
+//slot holding w, or the empty slot where it belongs
+static tslot* tree_hashslot(tree* t, const char* w, size_t len, uint64_t h) {
+  size_t mask = t->table_cap - 1;
+  for (size_t i = h & mask; ; i = (i + 1) & mask) {
+    tslot* s = &t->table[i];
+    if (s->node == NULL) { return s; }
+    if (s->hash != h) { continue; }
+    TREE_COUNT(t, compares, 1);
+    if (wordcmp(w, len, s->node->word) == 0) { return s; }
+  }
 }
 
 //-------------------------------------------------------------------------
-void tree_print(tnode* p) {
-  printf("%s -- %d  (%p, %p)\n", p->word, p->count, p->left, p->right);
+//doubles the table, keeping the load factor at or under one half
+static void tree_hashgrow(tree* t) {
+  tslot* old = t->table;
+  size_t cap = t->table_cap;
+
+  t->table_cap = cap == 0 ? 1024 : cap * 2;
+  t->table = (tslot*)calloc(t->table_cap, sizeof(tslot));
+  TREE_COUNT(t, allocs, 1);
+  size_t mask = t->table_cap - 1;
+  for (size_t i = 0; i < cap; ++i) {
+    if (old[i].node == NULL) { continue; }
+    size_t j = old[i].hash & mask;
+    while (t->table[j].node != NULL) { j = (j + 1) & mask; }
+    t->table[j] = old[i];
+  }
+  free(old);
+}
+
+//-------------------------------------------------------------------------
+//counts w without touching the tree; ordered operations rebuild it later
+static tnode* tree_hashadd(tree* t, const char* w, size_t len, int n) {
+  if (2 * (t->size + 1) > t->table_cap) { tree_hashgrow(t); }
+
+  uint64_t h = tree_hash(w, len);
+  tslot* s = tree_hashslot(t, w, len, h);
+  if (s->node != NULL) {
+    s->node->count += n;
+    return s->node;
+  }
+
+  s->node = tree_newnode(t, w, len);
+  s->node->count = n;
+  s->hash = h;
+  t->size++;
+  t->sorted = false;
+  return s->node;
+}
+
+//-------------------------------------------------------------------------
+//replaces the table contents with the nodes v[0, n), which already form
+//the tree at root
+static void tree_hashindex(tree* t, tnode** v, size_t n) {
+  free(t->table);
+  t->table = NULL;
+  t->table_cap = 0;
+  t->sorted = true;
+  while (2 * n > t->table_cap) { tree_hashgrow(t); }
+
+  for (size_t i = 0; i < n; ++i) {
+    const char* w = v[i]->word;
+    size_t len = strlen(w);
+    uint64_t h = tree_hash(w, len);
+    tslot* s = tree_hashslot(t, w, len, h);
+    s->node = v[i];
+    s->hash = h;
+  }
 }
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_inorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
+//TREE_CONCURRENT insert. A link only ever changes from NULL to a fully
+//built node, published with a release CAS and followed with acquire loads,
+//so finds and adds need no lock and a known word costs one atomic add. A
+//thread that loses the race for a link keeps descending from the winner
+//with its own node in hand. Nodes never move while threads are adding.
+static tnode* tree_addshared(tree* t, const char* w, size_t len, int n) {
+  tnode** link = &t->root;
+  tnode* fresh = NULL;
 
-  tree_printnodes_inorder(t, p->left);
-  tree_print(p);
-  tree_printnodes_inorder(t, p->right);
+  for (;;) {
+    tnode* p = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+    if (p == NULL) {
+      if (fresh == NULL) {
+        fresh = tree_newnode(t, w, len);
+        fresh->count = n;
+      }
+      if (__atomic_compare_exchange_n(link, &p, fresh, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&t->size, 1, __ATOMIC_RELAXED);
+        return fresh;
+      }
+    }
+
+    TREE_COUNT(t, compares, 1);
+    int compare = wordcmp(w, len, p->word);
+    if (compare == 0) {
+      __atomic_fetch_add(&p->count, n, __ATOMIC_RELAXED);
+      if (fresh != NULL) { tnode_delete(fresh); }
+      return p;
+    }
+    link = compare < 0 ? &p->left : &p->right;
+  }
 }
 
 //-------------------------------------------------------------------------
-void tree_print_inorder(tree* t) {
-  tree_printnodes_inorder(t, t->root);
+tnode* tree_add(tree* t, const char* word) { return tree_addn(t, word, strlen(word)); }
+
+//-------------------------------------------------------------------------
+tnode* tree_addn(tree* t, const char* word, size_t len) {
+  uint64_t t0 = timing_start();
+  TREE_COUNT(t, adds, 1);
+  tnode* p = t->mode & TREE_CONCURRENT ? tree_addshared(t, word, len, 1)
+           : t->mode & TREE_HASH ? tree_hashadd(t, word, len, 1)
+           : tree_addnode(t, &(t->root), word, len, 1);
+  timing_insert(t0);
+  return p;
 }
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_preorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
+tnode* tree_find(tree* t, const char* word) {
+  TREE_COUNT(t, finds, 1);
+  if (t->mode & TREE_HASH) {
+    if (t->size == 0) { return NULL; }
+    size_t len = strlen(word);
+    return tree_hashslot(t, word, len, tree_hash(word, len))->node;
+  }
+
+  //acquire loads keep finds safe during TREE_CONCURRENT adds; on x86 and
+  //for the other modes they are ordinary loads
+  tnode* p = __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+  int compare;
+
+  while (p != NULL && (TREE_COUNT(t, compares, 1), compare = strcmp(word, p->word)) != 0) {
+    p = __atomic_load_n(compare < 0 ? &p->left : &p->right, __ATOMIC_ACQUIRE);
+  }
+  return p;
+}
 
-  tree_print(p);
-  tree_printnodes_preorder(t, p->left);
-  tree_printnodes_preorder(t, p->right);
+//-------------------------------------------------------------------------
+int tree_count(tree* t, const char* word) {
+  tnode* p = tree_find(t, word);
+  return p == NULL ? 0 : __atomic_load_n(&p->count, __ATOMIC_RELAXED);
 }
 
 //-------------------------------------------------------------------------
-void tree_print_preorder(tree* t) {
-  tree_printnodes_preorder(t, t->root);
+static int tree_querycmp(const void* a, const void* b) {
+  return strcmp(**(const char* const* const*)a, **(const char* const* const*)b);
 }
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_postorder(tree* t, tnode* p) {
-  if (p == NULL) { return; }
+typedef struct find_frame find_frame;
+struct find_frame {
+  tnode* p;
+  size_t lo;
+  size_t hi;
+};
+
+//-------------------------------------------------------------------------
+//out[i] = tree_find(t, words[i]) for all n words. The queries are sorted
+//once and then split around each node on a single descent, so a subtree
+//is entered once for all the queries that fall in it and shared upper
+//levels are compared against only once per batch.
+void tree_find_many(tree* t, const char** words, size_t n, tnode** out) {
+  if (t->mode & TREE_HASH) {   //one probe each beats a shared descent
+    for (size_t i = 0; i < n; ++i) { out[i] = tree_find(t, words[i]); }
+    return;
+  }
+
+  TREE_COUNT(t, finds, n);
+  const char** order[64];
+  const char*** q = n <= 64 ? order : (const char***)malloc(n * sizeof(const char**));
+  for (size_t i = 0; i < n; ++i) { q[i] = &words[i]; }
+  qsort(q, n, sizeof(const char**), tree_querycmp);
+
+  size_t top = 0, cap = 64;
+  find_frame* stack = (find_frame*)malloc(cap * sizeof(find_frame));
+  stack[top++] = (find_frame){t->root, 0, n};
+
+  while (top > 0) {
+    find_frame f = stack[--top];
+    if (f.lo >= f.hi) { continue; }
+    if (f.p == NULL) {
+      for (size_t i = f.lo; i < f.hi; ++i) { out[q[i] - words] = NULL; }
+      continue;
+    }
+
+    size_t lo = f.lo, hi = f.hi;   //first query >= this node's word
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      TREE_COUNT(t, compares, 1);
+      if (strcmp(*q[mid], f.p->word) < 0) { lo = mid + 1; } else { hi = mid; }
+    }
+    size_t eq = lo;
+    while (eq < f.hi && (TREE_COUNT(t, compares, 1), strcmp(*q[eq], f.p->word) == 0)) {
+      out[q[eq++] - words] = f.p;
+    }
+
+    if (top + 2 > cap) {
+      cap *= 2;
+      stack = (find_frame*)realloc(stack, cap * sizeof(find_frame));
+    }
+    stack[top++] = (find_frame){f.p->left, f.lo, lo};
+    stack[top++] = (find_frame){f.p->right, eq, f.hi};
+  }
 
-  tree_printnodes_postorder(t, p->left);
-  tree_printnodes_postorder(t, p->right);
-  tree_print(p);
+  free(stack);
+  if (q != order) { free(q); }
 }
 
 //-------------------------------------------------------------------------
-void tree_print_postorder(tree* t) {
-  tree_printnodes_postorder(t, t->root);
+//first node whose word is >= key, NULL when every word is smaller
+tnode* tree_lower_bound(tree* t, const char* key) {
+  tree_sort(t);
+  tnode* p = t->root;
+  tnode* best = NULL;
+
+  while (p != NULL) {
+    if (strcmp(key, p->word) <= 0) {
+      best = p;
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+  return best;
+}
+
+//-------------------------------------------------------------------------
+//first node whose word is > key, NULL when no word is larger
+tnode* tree_upper_bound(tree* t, const char* key) {
+  tree_sort(t);
+  tnode* p = t->root;
+  tnode* best = NULL;
+
+  while (p != NULL) {
+    if (strcmp(key, p->word) < 0) {
+      best = p;
+      p = p->left;
+    } else {
+      p = p->right;
+    }
+  }
+  return best;
+}
+
+//-------------------------------------------------------------------------
+//calls visit on every node whose word starts with the first n letters of
+//prefix, in order, in O(log size + matches). Returns the node following
+//the range (NULL at the end of the tree), where a scan can carry on.
+tnode* tree_prefix_range(tree* t, const char* prefix, size_t n, tree_visit visit, void* arg) {
+  tree_sort(t);
+  size_t len = strlen(prefix);
+  if (n > len) { n = len; }
+
+  tree_iter it;
+  tnode* p;
+  tree_iter_begin(&it, t, TREE_INORDER);
+  tree_iter_seek(&it, prefix, n);
+
+  while ((p = tree_iter_next(&it)) != NULL && strncmp(p->word, prefix, n) == 0) {
+    visit(p, arg);
+  }
+  tree_iter_end(&it);
+  return p;
+}
+
+//-------------------------------------------------------------------------
+static size_t tree_flatten(tree* t, tnode** out) {
+  size_t i = 0;
+  tree_iter it;
+  tnode* p;
+
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) { out[i++] = p; }
+  tree_iter_end(&it);
+  return i;
+}
+
+//-------------------------------------------------------------------------
+//links the sorted nodes v[lo, hi) into a minimum-height subtree
+static tnode* tree_buildnodes(tnode** v, size_t lo, size_t hi) {
+  if (lo >= hi) { return NULL; }
+
+  size_t mid = lo + (hi - lo) / 2;
+  tnode* p = v[mid];
+  p->left = tree_buildnodes(v, lo, mid);
+  p->right = tree_buildnodes(v, mid + 1, hi);
+  tnode_update(p);
+  return p;
+}
+
+//-------------------------------------------------------------------------
+static int tree_nodecmp(const void* a, const void* b) {
+  return strcmp((*(tnode* const*)a)->word, (*(tnode* const*)b)->word);
+}
+
+//-------------------------------------------------------------------------
+//in TREE_HASH mode, links the table's nodes into a balanced tree if words
+//were added since the last ordered use; a no-op otherwise
+static void tree_sort(tree* t) {
+  if (t->sorted) { return; }
+
+  tnode** v = (tnode**)malloc((t->size + 1) * sizeof(tnode*));
+  size_t k = 0;
+  for (size_t i = 0; i < t->table_cap; ++i) {
+    if (t->table[i].node != NULL) { v[k++] = t->table[i].node; }
+  }
+  qsort(v, k, sizeof(tnode*), tree_nodecmp);
+  t->root = tree_buildnodes(v, 0, k);
+  t->sorted = true;
+  free(v);
+}
+
+//-------------------------------------------------------------------------
+//sums src into dst with one in-order merge-join and rebuilds dst balanced,
+//in O(n + m). src is left empty: its nodes (or arena blocks) move to dst
+//when both trees use the same storage, otherwise its words are copied.
+void tree_merge(tree* dst, tree* src) {
+  uint64_t t0 = timing_start();
+  size_t n = dst->size, m = src->size;
+  tnode** a = (tnode**)malloc((n + m + 1) * sizeof(tnode*));
+  tnode** b = (tnode**)malloc((m + 1) * sizeof(tnode*));
+  tree_flatten(dst, a + m);   //dst run sits at the back of a
+  tree_flatten(src, b);
+
+  bool arena_dst = dst->mode & TREE_ARENA, arena_src = src->mode & TREE_ARENA;
+  bool adopt = arena_dst == arena_src;
+  size_t i = m, j = 0, k = 0;
+
+  while (i < n + m || j < m) {
+    int compare = i == n + m ? 1 : j == m ? -1 : strcmp(a[i]->word, b[j]->word);
+    if (compare < 0) {
+      a[k++] = a[i++];
+    } else if (compare == 0) {
+      a[i]->count += b[j]->count;
+      if (!arena_src) { tnode_delete(b[j]); }
+      a[k++] = a[i++];
+      ++j;
+    } else {
+      tnode* q = b[j++];
+      if (!adopt) {
+        tnode* p = tree_newnode(dst, q->word, strlen(q->word));
+        p->count = q->count;
+        if (!arena_src) { tnode_delete(q); }
+        q = p;
+      }
+      a[k++] = q;
+    }
+  }
+
+  if (arena_src) {
+    if (adopt) {
+      arena_block** tail = &dst->pool.head;
+      while (*tail != NULL) { tail = &(*tail)->next; }
+      *tail = src->pool.head;
+      dst->pool.reserved += src->pool.reserved;
+      dst->pool.used += src->pool.used;
+      src->pool.head = NULL;
+    }
+    arena_release(&src->pool);
+  }
+
+  dst->root = tree_buildnodes(a, 0, k);
+  dst->size = k;
+  if (dst->mode & TREE_HASH) { tree_hashindex(dst, a, k); }
+  src->root = NULL;
+  src->size = 0;
+  if (src->mode & TREE_HASH) { tree_hashindex(src, a, 0); }
+  free(a);
+  free(b);
+  timing_stop(PHASE_MERGE, t0);
+}
+
+//-------------------------------------------------------------------------
+static int tree_paircmp(const void* a, const void* b) {
+  return strcmp(((const tree_pair*)a)->word, ((const tree_pair*)b)->word);
+}
+
+//-------------------------------------------------------------------------
+//builds a minimum-height tree from (word, count) pairs in O(n) when they
+//are already strictly ascending; otherwise pairs is sorted in place first
+//and repeated words have their counts summed. Nodes already in t are
+//merged with the new ones.
+void tree_build_sorted(tree* t, tree_pair* pairs, size_t n) {
+  bool sorted = true;
+  for (size_t i = 1; sorted && i < n; ++i) {
+    sorted = strcmp(pairs[i - 1].word, pairs[i].word) < 0;
+  }
+  if (!sorted) { qsort(pairs, n, sizeof(tree_pair), tree_paircmp); }
+
+  tree* dst = t;
+  if (t->size != 0) { dst = tree_create_mode(t->mode); }
+
+  tnode** v = (tnode**)malloc((n + 1) * sizeof(tnode*));
+  size_t k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!sorted && k > 0 && strcmp(v[k - 1]->word, pairs[i].word) == 0) {
+      v[k - 1]->count += pairs[i].count;
+      continue;
+    }
+    v[k] = tree_newnode(dst, pairs[i].word, strlen(pairs[i].word));
+    v[k++]->count = pairs[i].count;
+  }
+
+  dst->root = tree_buildnodes(v, 0, k);
+  dst->size = k;
+  if (dst->mode & TREE_HASH) { tree_hashindex(dst, v, k); }
+  free(v);
+
+  if (dst != t) {
+    tree_merge(t, dst);
+    free(dst);
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_clear(tree* t) {
+  uint64_t t0 = timing_start();
+  tree_delete(t);
+  t->root = NULL;
+  t->size = 0;
+  timing_stop(PHASE_CLEAR, t0);
+}
+
+//-------------------------------------------------------------------------
+void tree_print(tnode* p) {
+  printf("%s -- %d  (%p, %p)\n", p->word, p->count, p->left, p->right);
+}
+
+//-------------------------------------------------------------------------
+#define WRITER_BUF_SIZE (1 << 20)
+
+//-------------------------------------------------------------------------
+void tree_writer_open(tree_writer* w, int fd, int format) {
+  fflush(stdout);   //keep earlier printf output ahead of ours
+  w->fd = fd;
+  w->format = format;
+  w->len = 0;
+  w->cap = WRITER_BUF_SIZE;
+  w->buf = (char*)malloc(w->cap);
+}
+
+//-------------------------------------------------------------------------
+static void write_all(int fd, const char* s, size_t n) {
+  while (n > 0) {
+    ssize_t k = write(fd, s, n);
+    if (k < 0) {
+      if (errno == EINTR) { continue; }
+      perror("write");
+      exit(1);
+    }
+    s += k;
+    n -= k;
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_writer_flush(tree_writer* w) {
+  write_all(w->fd, w->buf, w->len);
+  w->len = 0;
+}
+
+//-------------------------------------------------------------------------
+static void writer_put(tree_writer* w, const char* s, size_t n) {
+  if (w->len + n > w->cap) { tree_writer_flush(w); }
+  if (n > w->cap) {
+    write_all(w->fd, s, n);
+    return;
+  }
+  memcpy(w->buf + w->len, s, n);
+  w->len += n;
+}
+
+//-------------------------------------------------------------------------
+static size_t format_int(char* out, long long v) {
+  char tmp[24];
+  size_t n = 0, i = 0;
+  unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+
+  do { tmp[n++] = '0' + u % 10; u /= 10; } while (u != 0);
+  if (v < 0) { out[i++] = '-'; }
+  while (n > 0) { out[i++] = tmp[--n]; }
+  return i;
+}
+
+//-------------------------------------------------------------------------
+//same text as printf's %p on glibc
+static size_t format_ptr(char* out, const void* p) {
+  if (p == NULL) {
+    memcpy(out, "(nil)", 5);
+    return 5;
+  }
+
+  char tmp[16];
+  size_t n = 0, i = 2;
+  uintptr_t u = (uintptr_t)p;
+  do { tmp[n++] = "0123456789abcdef"[u & 0xF]; u >>= 4; } while (u != 0);
+  out[0] = '0';
+  out[1] = 'x';
+  while (n > 0) { out[i++] = tmp[--n]; }
+  return i;
+}
+
+//-------------------------------------------------------------------------
+void tree_writer_node(tree_writer* w, tnode* p) {
+  char line[96];
+  size_t n = 0;
+
+  writer_put(w, p->word, strlen(p->word));
+  switch (w->format) {
+  case TREE_FMT_TSV:
+    line[n++] = '\t';
+    n += format_int(line + n, p->count);
+    break;
+  case TREE_FMT_DEBUG:
+    memcpy(line, " -- ", 4);
+    n = 4 + format_int(line + 4, p->count);
+    memcpy(line + n, "  (", 3);
+    n += 3;
+    n += format_ptr(line + n, p->left);
+    memcpy(line + n, ", ", 2);
+    n += 2;
+    n += format_ptr(line + n, p->right);
+    line[n++] = ')';
+    break;
+  default:
+    line[n++] = ' ';
+    n += format_int(line + n, p->count);
+    break;
+  }
+  line[n++] = '\n';
+  writer_put(w, line, n);
+}
+
+//-------------------------------------------------------------------------
+void tree_writer_close(tree_writer* w) {
+  tree_writer_flush(w);
+  free(w->buf);
+  w->buf = NULL;
+}
+
+//-------------------------------------------------------------------------
+void tree_write(tree* t, int order, tree_writer* w) {
+  uint64_t t0 = timing_start();
+  tree_iter it;
+  tnode* p;
+
+  tree_iter_begin(&it, t, order);
+  while ((p = tree_iter_next(&it)) != NULL) { tree_writer_node(w, p); }
+  tree_iter_end(&it);
+  timing_stop(PHASE_PRINT, t0);
+}
+
+//-------------------------------------------------------------------------
+static void tree_print_order(tree* t, int order) {
+  tree_writer w;
+
+  tree_writer_open(&w, STDOUT_FILENO, TREE_FMT_DEBUG);
+  tree_write(t, order, &w);
+  tree_writer_close(&w);
+}
+
+//-------------------------------------------------------------------------
+void tree_print_inorder(tree* t) { tree_print_order(t, TREE_INORDER); }
+
+//-------------------------------------------------------------------------
+void tree_print_preorder(tree* t) { tree_print_order(t, TREE_PREORDER); }
+
+//-------------------------------------------------------------------------
+void tree_print_postorder(tree* t) { tree_print_order(t, TREE_POSTORDER); }
+
+//-------------------------------------------------------------------------
+void tqueue_init(tqueue* q) {
+  q->cap = 64;
+  q->head = 0;
+  q->len = 0;
+  q->buf = (tnode**)malloc(q->cap * sizeof(tnode*));
+}
+
+//-------------------------------------------------------------------------
+//doubles the ring when full, unwrapping it so head starts at 0
+void tqueue_push(tqueue* q, tnode* p) {
+  if (q->len == q->cap) {
+    tnode** buf = (tnode**)malloc(2 * q->cap * sizeof(tnode*));
+    size_t first = q->cap - q->head;
+    memcpy(buf, q->buf + q->head, first * sizeof(tnode*));
+    memcpy(buf + first, q->buf, q->head * sizeof(tnode*));
+    free(q->buf);
+    q->buf = buf;
+    q->head = 0;
+    q->cap *= 2;
+  }
+  q->buf[(q->head + q->len++) & (q->cap - 1)] = p;
+}
+
+//-------------------------------------------------------------------------
+tnode* tqueue_pop(tqueue* q) {
+  tnode* p = q->buf[q->head];
+  q->head = (q->head + 1) & (q->cap - 1);
+  q->len--;
+  return p;
+}
+
+//-------------------------------------------------------------------------
+void tqueue_free(tqueue* q) {
+  free(q->buf);
+  q->buf = NULL;
+  q->len = 0;
+}
+
+//-------------------------------------------------------------------------
+void tree_print_levelorder(tree* t) {
+  tree_writer w;
+  tqueue q;
+
+  tree_sort(t);
+  tqueue_init(&q);
+  tree_writer_open(&w, STDOUT_FILENO, TREE_FMT_DEBUG);
+  if (t->root != NULL) { tqueue_push(&q, t->root); }
+
+  while (q.len > 0) {
+    tnode* p = tqueue_pop(&q);
+    tree_writer_node(&w, p);
+    if (p->left != NULL) { tqueue_push(&q, p->left); }
+    if (p->right != NULL) { tqueue_push(&q, p->right); }
+  }
+
+  tree_writer_close(&w);
+  tqueue_free(&q);
+}
+
+//-------------------------------------------------------------------------
+//one line per depth with the number of nodes on it, for judging tree shape
+void tree_print_levelwidths(tree* t) {
+  tqueue q;
+  size_t level = 0, widest = 0;
+
+  tree_sort(t);
+  tqueue_init(&q);
+  if (t->root != NULL) { tqueue_push(&q, t->root); }
+
+  while (q.len > 0) {
+    size_t width = q.len;
+    printf("level %zu: %zu\n", level++, width);
+    if (width > widest) { widest = width; }
+
+    for (size_t i = 0; i < width; ++i) {
+      tnode* p = tqueue_pop(&q);
+      if (p->left != NULL) { tqueue_push(&q, p->left); }
+      if (p->right != NULL) { tqueue_push(&q, p->right); }
+    }
+  }
+  printf("height %zu, widest level %zu, %zu nodes\n", level, widest, tree_size(t));
+
+  tqueue_free(&q);
+}
+
+//-------------------------------------------------------------------------
+//walks the tree level by level, so depths come from the queue and a
+//degenerate tree costs no recursion
+void tree_stats(tree* t, tree_stat* s) {
+  tqueue q;
+  size_t depth = 0, depths = 0;
+
+  memset(s, 0, sizeof(*s));
+  tree_sort(t);
+  tqueue_init(&q);
+  if (t->root != NULL) { tqueue_push(&q, t->root); }
+
+  while (q.len > 0) {
+    size_t width = q.len;
+    depths += depth * width;
+    for (size_t i = 0; i < width; ++i) {
+      tnode* p = tqueue_pop(&q);
+      s->word_bytes += strlen(p->word) + 1;
+      if (p->left != NULL) { tqueue_push(&q, p->left); }
+      if (p->right != NULL) { tqueue_push(&q, p->right); }
+    }
+    s->nodes += width;
+    ++depth;
+  }
+  tqueue_free(&q);
+
+  size_t used;
+  s->height = depth;
+  s->avg_depth = s->nodes == 0 ? 0 : (double)depths / s->nodes;
+  s->node_bytes = s->nodes * sizeof(tnode);
+  s->table_bytes = t->table_cap * sizeof(tslot);
+  tree_memory(t, &s->reserved, &used);
+  s->ops = t->ops;
+}
+
+//-------------------------------------------------------------------------
+//snapshot layout: header, uint64 word offsets, int32 counts, then the word
+//blob. Everything is addressed by offset so the image maps anywhere.
+#define TREE_IMAGE_MAGIC "TREEIMG1"
+
+typedef struct image_header image_header;
+struct image_header {
+  char magic[8];
+  uint64_t size;
+  uint64_t bytes;    //of the word blob
+};
+
+//-------------------------------------------------------------------------
+//writes filename.tmp and renames it over filename, so a process loading
+//the image never sees a partial one
+void tree_save(tree* t, const char* filename) {
+  size_t n = strlen(filename);
+  char* tmp = (char*)malloc(n + 5);
+  memcpy(tmp, filename, n);
+  memcpy(tmp + n, ".tmp", 5);
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Error opening file: %s\n", tmp);
+    exit(1);
+  }
+
+  tree_writer w;
+  tree_iter it;
+  tnode* p;
+  image_header h = {TREE_IMAGE_MAGIC, t->size, 0};
+
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) { h.bytes += strlen(p->word) + 1; }
+  tree_iter_end(&it);
+
+  tree_writer_open(&w, fd, TREE_FMT_PLAIN);
+  writer_put(&w, (const char*)&h, sizeof(h));
+
+  uint64_t offset = 0;
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) {
+    writer_put(&w, (const char*)&offset, sizeof(offset));
+    offset += strlen(p->word) + 1;
+  }
+  tree_iter_end(&it);
+
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) {
+    int32_t count = p->count;
+    writer_put(&w, (const char*)&count, sizeof(count));
+  }
+  tree_iter_end(&it);
+
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while ((p = tree_iter_next(&it)) != NULL) { writer_put(&w, p->word, strlen(p->word) + 1); }
+  tree_iter_end(&it);
+
+  tree_writer_close(&w);
+  if (close(fd) < 0 || rename(tmp, filename) < 0) {
+    fprintf(stderr, "Error writing file: %s\n", filename);
+    exit(1);
+  }
+  free(tmp);
+}
+
+//-------------------------------------------------------------------------
+//word offsets must start at 0 and strictly ascend inside the blob, so every
+//word is in bounds and NUL-terminated by the next one (or the final NUL)
+static bool image_offsets_valid(const uint64_t* offset, uint64_t n, uint64_t bytes) {
+  if (n > 0 && offset[0] != 0) { return false; }
+  for (uint64_t i = 0; i < n; ++i) {
+    if (offset[i] >= bytes || (i > 0 && offset[i] <= offset[i - 1])) { return false; }
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+//maps an image read-only; NULL, with a message, if it is not a valid one
+tree_image* tree_load(const char* filename) {
+  size_t bytes;
+  const char* base = file_map(filename, &bytes, false);
+  const image_header* h = (const image_header*)base;
+
+  if (base == NULL || bytes < sizeof(image_header) ||
+      memcmp(h->magic, TREE_IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->size > bytes / (sizeof(uint64_t) + sizeof(int32_t)) ||
+      bytes != sizeof(image_header) + h->size * (sizeof(uint64_t) + sizeof(int32_t)) + h->bytes ||
+      (h->bytes > 0 && base[bytes - 1] != '\0') ||
+      !image_offsets_valid((const uint64_t*)(base + sizeof(image_header)), h->size, h->bytes)) {
+    fprintf(stderr, "Not a tree image: %s\n", filename);
+    if (base != NULL) { munmap((void*)base, bytes); }
+    return NULL;
+  }
+  madvise((void*)base, bytes, MADV_WILLNEED);
+
+  tree_image* img = (tree_image*)malloc(sizeof(tree_image));
+  img->base = base;
+  img->bytes = bytes;
+  img->size = h->size;
+  img->offset = (const uint64_t*)(base + sizeof(image_header));
+  img->count = (const int32_t*)(img->offset + h->size);
+  img->words = (const char*)(img->count + h->size);
+  return img;
+}
+
+//-------------------------------------------------------------------------
+void tree_image_close(tree_image* img) {
+  munmap((void*)img->base, img->bytes);
+  free(img);
+}
+
+//-------------------------------------------------------------------------
+//index of the first word >= word, img->size when there is none
+size_t tree_image_lower_bound(tree_image* img, const char* word) {
+  size_t lo = 0, hi = img->size;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(img->words + img->offset[mid], word) < 0) { lo = mid + 1; } else { hi = mid; }
+  }
+  return lo;
+}
+
+//-------------------------------------------------------------------------
+int tree_image_count(tree_image* img, const char* word) {
+  size_t i = tree_image_lower_bound(img, word);
+  if (i == img->size || strcmp(img->words + img->offset[i], word) != 0) { return 0; }
+  return img->count[i];
+}
+
+//-------------------------------------------------------------------------
+void tree_image_write(tree_image* img, tree_writer* w) {
+  tnode e = {.height = 1};
+
+  for (size_t i = 0; i < img->size; ++i) {
+    e.word = img->words + img->offset[i];
+    e.count = img->count[i];
+    tree_writer_node(w, &e);
+  }
+}
+
+//-------------------------------------------------------------------------
+void tree_image_print(tree_image* img) {
+  tree_writer w;
+
+  tree_writer_open(&w, STDOUT_FILENO, TREE_FMT_DEBUG);
+  tree_image_write(img, &w);
+  tree_writer_close(&w);
+}
+
+//-------------------------------------------------------------------------
+btree* btree_create() {
+  btree* p = (btree*)malloc(sizeof(btree));
+  p->root = NULL;
+  p->size = 0;
+  p->height = 0;
+  p->pool.head = NULL;
+  p->pool.reserved = 0;
+  p->pool.used = 0;
+  return p;
+}
+
+//-------------------------------------------------------------------------
+void btree_clear(btree* t) {
+  arena_release(&t->pool);
+  t->root = NULL;
+  t->size = 0;
+  t->height = 0;
+}
+
+//-------------------------------------------------------------------------
+size_t btree_size(btree* t) { return t->size; }
+
+//-------------------------------------------------------------------------
+static bnode* bnode_create(btree* t, bool leaf) {
+  size_t size = leaf ? offsetof(bnode, child) : sizeof(bnode);
+  bnode* p = (bnode*)arena_alloc(&t->pool, size, sizeof(void*));
+  p->n = 0;
+  p->leaf = leaf;
+  return p;
+}
+
+//-------------------------------------------------------------------------
+//first four bytes of the word, zero padded, so that comparing prefixes as
+//integers orders words the way strcmp does
+static uint32_t btree_prefix(const char* w, size_t len) {
+  uint32_t pre = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    pre = pre << 8 | (i < len ? (unsigned char)w[i] : 0);
+  }
+  return pre;
+}
+
+//-------------------------------------------------------------------------
+//index of the first key in p that is >= w; *found when it equals w
+static int bnode_search(bnode* p, const char* w, size_t len, uint32_t pre, bool* found) {
+  int i = 0;
+
+  while (i < p->n && p->prefix[i] < pre) { ++i; }
+  for (; i < p->n && p->prefix[i] == pre; ++i) {
+    int compare = wordcmp(w, len, p->word[i]);
+    if (compare <= 0) {
+      *found = compare == 0;
+      return i;
+    }
+  }
+  *found = false;
+  return i;
+}
+
+//-------------------------------------------------------------------------
+//copies keys src[from, from + n) to dst[to, to + n); ranges may overlap
+static void bnode_move(bnode* dst, int to, bnode* src, int from, int n) {
+  memmove(&dst->prefix[to], &src->prefix[from], n * sizeof(uint32_t));
+  memmove(&dst->count[to], &src->count[from], n * sizeof(int));
+  memmove(&dst->word[to], &src->word[from], n * sizeof(const char*));
+}
+
+//-------------------------------------------------------------------------
+//splits the full child p->child[i] around its median, which moves up to p
+static void bnode_split(btree* t, bnode* p, int i) {
+  bnode* y = p->child[i];
+  bnode* z = bnode_create(t, y->leaf);
+
+  z->n = BTREE_ORDER - 1;
+  bnode_move(z, 0, y, BTREE_ORDER, BTREE_ORDER - 1);
+  if (!y->leaf) {
+    memcpy(z->child, &y->child[BTREE_ORDER], BTREE_ORDER * sizeof(bnode*));
+  }
+  y->n = BTREE_ORDER - 1;
+
+  memmove(&p->child[i + 2], &p->child[i + 1], (p->n - i) * sizeof(bnode*));
+  p->child[i + 1] = z;
+  bnode_move(p, i + 1, p, i, p->n - i);
+  bnode_move(p, i, y, BTREE_ORDER - 1, 1);
+  p->n++;
+}
+
+//-------------------------------------------------------------------------
+//adds n to w's count and returns the new count. A new word is inserted in
+//a second descent that splits full nodes ahead of itself, so a leaf always
+//has room and nothing propagates back up.
+static int btree_addword(btree* t, const char* w, size_t len, int n) {
+  uint32_t pre = btree_prefix(w, len);
+  bool found;
+  int i;
+
+  for (bnode* p = t->root; p != NULL; p = p->leaf ? NULL : p->child[i]) {
+    i = bnode_search(p, w, len, pre, &found);
+    if (found) { return p->count[i] += n; }
+  }
+
+  if (t->root == NULL) {
+    t->root = bnode_create(t, true);
+    t->height = 1;
+  } else if (t->root->n == BTREE_MAX) {
+    bnode* r = bnode_create(t, false);
+    r->child[0] = t->root;
+    bnode_split(t, r, 0);
+    t->root = r;
+    t->height++;
+  }
+
+  bnode* p = t->root;
+  while (!p->leaf) {
+    i = bnode_search(p, w, len, pre, &found);
+    if (p->child[i]->n == BTREE_MAX) {
+      bnode_split(t, p, i);
+      if (wordcmp(w, len, p->word[i]) > 0) { ++i; }
+    }
+    p = p->child[i];
+  }
+
+  i = bnode_search(p, w, len, pre, &found);
+  bnode_move(p, i + 1, p, i, p->n - i);
+  p->prefix[i] = pre;
+  p->count[i] = n;
+  p->word[i] = arena_strdup(&t->pool, w, len);
+  p->n++;
+  t->size++;
+  return n;
+}
+
+//-------------------------------------------------------------------------
+int btree_add(btree* t, const char* word) { return btree_addword(t, word, strlen(word), 1); }
+
+//-------------------------------------------------------------------------
+int btree_addn(btree* t, const char* word, size_t len) { return btree_addword(t, word, len, 1); }
+
+//-------------------------------------------------------------------------
+int btree_count(btree* t, const char* word) {
+  size_t len = strlen(word);
+  uint32_t pre = btree_prefix(word, len);
+  bool found;
+  int i;
+
+  for (bnode* p = t->root; p != NULL; p = p->leaf ? NULL : p->child[i]) {
+    i = bnode_search(p, word, len, pre, &found);
+    if (found) { return p->count[i]; }
+  }
+  return 0;
+}
+
+//-------------------------------------------------------------------------
+static void btree_iter_descend(btree_iter* it, bnode* p) {
+  while (p != NULL) {
+    it->node[it->top] = p;
+    it->pos[it->top++] = 0;
+    p = p->leaf ? NULL : p->child[0];
+  }
+}
+
+//-------------------------------------------------------------------------
+//in-order walk; the stack holds one (node, next key) pair per level
+void btree_iter_begin(btree_iter* it, btree* t) {
+  it->top = 0;
+  btree_iter_descend(it, t->root);
+}
+
+//-------------------------------------------------------------------------
+bool btree_iter_next(btree_iter* it, const char** word, int* count) {
+  while (it->top > 0) {
+    bnode* p = it->node[it->top - 1];
+    int i = it->pos[it->top - 1];
+
+    if (i < p->n) {
+      *word = p->word[i];
+      *count = p->count[i];
+      it->pos[it->top - 1] = i + 1;
+      if (!p->leaf) { btree_iter_descend(it, p->child[i + 1]); }
+      return true;
+    }
+    it->top--;
+  }
+  return false;
+}
+
+//-------------------------------------------------------------------------
+//keys have no child pointers, so TREE_FMT_DEBUG shows them as (nil)
+void btree_write(btree* t, tree_writer* w) {
+  btree_iter it;
+  tnode e = {.height = 1};
+
+  btree_iter_begin(&it, t);
+  while (btree_iter_next(&it, &e.word, &e.count)) { tree_writer_node(w, &e); }
+}
+
+//-------------------------------------------------------------------------
+void btree_print_inorder(btree* t) {
+  tree_writer w;
+
+  tree_writer_open(&w, STDOUT_FILENO, TREE_FMT_DEBUG);
+  btree_write(t, &w);
+  tree_writer_close(&w);
+}
+
+//-------------------------------------------------------------------------
+void file_input_btree(btree* t, const char* filename) {
+  size_t size, len;
+  const char* base = file_map(filename, &size, false);
+  if (base == NULL) { return; }
+  const char* end = base + size;
+
+  for (const char* w = base; (w = token_next(w, end, &len)) != NULL; w += len) {
+    btree_addn(t, w, len);
+  }
+
+  munmap((void*)base, size);
 }
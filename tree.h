@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef TREE_H
 #define TREE_H
@@ -10,21 +11,219 @@ typedef struct tnode tnode;
 struct tnode {
   const char* word;
   int count;
+  int height;      //subtree height, maintained in TREE_AVL mode
   tnode* left;
   tnode* right;
 };
 
+//-------------------------------------------------------------------------
+typedef struct arena_block arena_block;
+struct arena_block {
+  arena_block* next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+//-------------------------------------------------------------------------
+typedef struct arena arena;
+struct arena {
+  arena_block* head;
+  size_t reserved;   //bytes obtained from malloc
+  size_t used;       //bytes handed out to nodes and words
+};
+
+//-------------------------------------------------------------------------
+//AVL, ARENA and HASH combine freely; CONCURRENT must be used alone, and
+//tree_create_mode exits with a message if another mode is or'ed in
+enum tree_mode {
+  TREE_PLAIN = 0,   //unbalanced BST, shape depends on insertion order
+  TREE_AVL   = 1,   //height-balanced, O(log n) insert on any input order
+  TREE_ARENA = 2,   //nodes and words carved from pool, freed all at once
+  TREE_HASH  = 4,   //adds count into a hash table, tree built on first ordered use
+  TREE_CONCURRENT = 8,   //many threads may add and find at once; plain BST only
+};
+
+//-------------------------------------------------------------------------
+//open-addressing slot for TREE_HASH mode, keyed on the word bytes
+typedef struct tslot tslot;
+struct tslot {
+  tnode* node;
+  uint64_t hash;
+};
+
+//-------------------------------------------------------------------------
+//operation counters, only advanced when tree.c is built with -DTREE_STATS
+typedef struct tree_ops tree_ops;
+struct tree_ops {
+  uint64_t adds;       //tree_add and tree_addn calls
+  uint64_t finds;      //tree_find calls and tree_find_many queries
+  uint64_t compares;   //word comparisons made by adds and finds
+  uint64_t allocs;     //malloc calls for nodes, words, arena blocks, tables
+};
+
 //-------------------------------------------------------------------------
 typedef struct tree tree;
 struct tree {
   tnode* root;
   size_t size;
+  int mode;
+  arena pool;        //only used in TREE_ARENA mode
+  tslot* table;      //only used in TREE_HASH mode, holds every node
+  size_t table_cap;  //power of two
+  bool sorted;       //false while root is missing nodes added to table
+  tree_ops ops;
+};
+
+//-------------------------------------------------------------------------
+//shape and footprint measured by tree_stats, plus a copy of the counters
+typedef struct tree_stat tree_stat;
+struct tree_stat {
+  size_t nodes;
+  size_t height;       //levels, so the deepest node is at depth height - 1
+  double avg_depth;    //root at depth 0
+  size_t node_bytes;   //tnodes
+  size_t word_bytes;   //words including their NULs
+  size_t table_bytes;  //TREE_HASH index
+  size_t reserved;     //everything obtained from malloc, as tree_memory
+  tree_ops ops;
 };
 
 //-------------------------------------------------------------------------
-tree* get_input(int argc, const char* argv[]);
+//read-only view of a snapshot written by tree_save. The arrays point into
+//the mapping, so loading allocates nothing per word and processes that
+//load the same image share its pages.
+typedef struct tree_image tree_image;
+struct tree_image {
+  const char* base;
+  size_t bytes;
+  size_t size;
+  const uint64_t* offset;   //of each word in words, ascending word order
+  const int32_t* count;
+  const char* words;        //NUL-terminated words back to back
+};
+
+//-------------------------------------------------------------------------
+//B-tree alternative to tree for very large vocabularies. A node is ~470
+//bytes: per key a 4-byte big-endian word prefix, a count and the word, kept
+//in parallel arrays so the search scans prefixes and only reads a word on
+//an equal prefix. Leaves are allocated without the child array.
+#define BTREE_ORDER 10                     //minimum degree
+#define BTREE_MAX (2 * BTREE_ORDER - 1)    //keys per node
+#define BTREE_MAXHEIGHT 32
+
+typedef struct bnode bnode;
+struct bnode {
+  int n;
+  bool leaf;
+  uint32_t prefix[BTREE_MAX];
+  int count[BTREE_MAX];
+  const char* word[BTREE_MAX];
+  bnode* child[BTREE_MAX + 1];   //internal nodes only
+};
+
+//-------------------------------------------------------------------------
+typedef struct btree btree;
+struct btree {
+  bnode* root;
+  size_t size;
+  int height;        //levels, 0 when empty
+  arena pool;        //nodes and words
+};
+
+//-------------------------------------------------------------------------
+typedef struct btree_iter btree_iter;
+struct btree_iter {
+  bnode* node[BTREE_MAXHEIGHT];
+  int pos[BTREE_MAXHEIGHT];
+  int top;
+};
+
+//-------------------------------------------------------------------------
+enum tree_order { TREE_INORDER, TREE_PREORDER, TREE_POSTORDER };
+
+#define TREE_ITER_SMALL 64
+
+//-------------------------------------------------------------------------
+//explicit-stack traversal; the stack lives inline until a path is deeper
+//than TREE_ITER_SMALL, so balanced trees never allocate
+typedef struct tree_iter tree_iter;
+struct tree_iter {
+  tnode** stack;
+  size_t top;
+  size_t cap;
+  int order;
+  tnode* cur;
+  tnode* last;       //last node returned, for postorder
+  tree* t;
+  tnode* small[TREE_ITER_SMALL];
+};
+
+//-------------------------------------------------------------------------
+//word scanner; AUTO picks the widest one the CPU and delimiter set allow
+enum tree_scanner {
+  TREE_SCAN_AUTO,
+  TREE_SCAN_SCALAR,
+  TREE_SCAN_SSE2,
+  TREE_SCAN_AVX2,
+};
+
+//-------------------------------------------------------------------------
+enum tree_format {
+  TREE_FMT_PLAIN,   //word count
+  TREE_FMT_TSV,     //word<TAB>count
+  TREE_FMT_DEBUG,   //word -- count  (left, right)
+};
+
+//-------------------------------------------------------------------------
+//formats nodes into one large buffer and hands it to write(2) when full
+typedef struct tree_writer tree_writer;
+struct tree_writer {
+  int fd;
+  int format;
+  size_t len;
+  size_t cap;
+  char* buf;
+};
+
+//-------------------------------------------------------------------------
+//growable ring buffer of node pointers; cap stays a power of two
+typedef struct tqueue tqueue;
+struct tqueue {
+  tnode** buf;
+  size_t head;
+  size_t len;
+  size_t cap;
+};
+
+//-------------------------------------------------------------------------
+typedef void (*tree_visit)(tnode* p, void* arg);
+
+//-------------------------------------------------------------------------
+typedef struct tree_pair tree_pair;
+struct tree_pair {
+  const char* word;
+  int count;
+};
+
+//-------------------------------------------------------------------------
+void* arena_alloc(arena* a, size_t n, size_t align);
+char* arena_strdup(arena* a, const char* s, size_t len);
+void arena_release(arena* a);
+
+//-------------------------------------------------------------------------
+tree* get_input(int argc, const char* argv[], int nthreads);
 void console_input(tree* t, int argc, const char* argv[]);
 void file_input(tree* t, const char* filename);
+void file_input_mmap(tree* t, const char* filename);
+void file_input_parallel(tree* t, const char* filename, int nthreads);
+void file_input_counts(tree* t, const char* filename);
+
+//-------------------------------------------------------------------------
+void tree_set_delims(const char* set);
+bool tree_set_scanner(int scanner);
+const char* token_next(const char* p, const char* end, size_t* len);
+void tree_addtokens(tree* t, const char* p, const char* end);
 
 //-------------------------------------------------------------------------
 tnode* tnode_create(const char* word);
@@ -32,38 +231,96 @@ void tnode_delete(tnode* t);
 
 //-------------------------------------------------------------------------
 tree* tree_create();
+tree* tree_create_mode(int mode);
 static void tree_deletenodes(tree* t, tnode* p);
 void tree_delete(tree* t);
 
 //-------------------------------------------------------------------------
 bool tree_empty(tree* t);
 size_t tree_size(tree* t);
+void tree_memory(tree* t, size_t* reserved, size_t* used);
+void tree_stats(tree* t, tree_stat* s);
 
 //-------------------------------------------------------------------------
-static tnode* tree_addnode(tree* t, tnode** p, const char* w);
+static tnode* tree_addnode(tree* t, tnode** p, const char* w, size_t len, int n);
 tnode* tree_add(tree* t, const char* word);
+tnode* tree_addn(tree* t, const char* word, size_t len);
+void tree_merge(tree* dst, tree* src);
+tnode* tree_find(tree* t, const char* word);
+int tree_count(tree* t, const char* word);
+void tree_find_many(tree* t, const char** words, size_t n, tnode** out);
+tnode* tree_lower_bound(tree* t, const char* key);
+tnode* tree_upper_bound(tree* t, const char* key);
+tnode* tree_prefix_range(tree* t, const char* prefix, size_t n, tree_visit visit, void* arg);
+void tree_build_sorted(tree* t, tree_pair* pairs, size_t n);
 
 //-------------------------------------------------------------------------
 void tree_clear(tree* t);
 void tree_print(tnode* p);
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_inorder(tree* t, tnode* p);
-void tree_print_inorder(tree* t);
+void tree_iter_begin(tree_iter* it, tree* t, int order);
+tnode* tree_iter_next(tree_iter* it);
+void tree_iter_seek(tree_iter* it, const char* word, size_t len);
+void tree_iter_end(tree_iter* it);
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_preorder(tree* t, tnode* p);
-void tree_print_preorder(tree* t);
+void tree_writer_open(tree_writer* w, int fd, int format);
+void tree_writer_node(tree_writer* w, tnode* p);
+void tree_writer_flush(tree_writer* w);
+void tree_writer_close(tree_writer* w);
+void tree_write(tree* t, int order, tree_writer* w);
 
 //-------------------------------------------------------------------------
-static void tree_printnodes_postorder(tree* t, tnode* p);
+void tree_print_inorder(tree* t);
+void tree_print_preorder(tree* t);
 void tree_print_postorder(tree* t);
 
+//-------------------------------------------------------------------------
+void tqueue_init(tqueue* q);
+void tqueue_push(tqueue* q, tnode* p);
+tnode* tqueue_pop(tqueue* q);
+void tqueue_free(tqueue* q);
+
 //-------------------------------------------------------------------------
 void tree_print_levelorder(tree* t);
+void tree_print_levelwidths(tree* t);
+
+//-------------------------------------------------------------------------
+void tree_save(tree* t, const char* filename);
+tree_image* tree_load(const char* filename);
+void tree_image_close(tree_image* img);
+size_t tree_image_lower_bound(tree_image* img, const char* word);
+int tree_image_count(tree_image* img, const char* word);
+void tree_image_write(tree_image* img, tree_writer* w);
+void tree_image_print(tree_image* img);
+
+//-------------------------------------------------------------------------
+btree* btree_create();
+void btree_clear(btree* t);
+size_t btree_size(btree* t);
+int btree_add(btree* t, const char* word);
+int btree_addn(btree* t, const char* word, size_t len);
+int btree_count(btree* t, const char* word);
+void btree_iter_begin(btree_iter* it, btree* t);
+bool btree_iter_next(btree_iter* it, const char** word, int* count);
+void btree_write(btree* t, tree_writer* w);
+void btree_print_inorder(btree* t);
+void file_input_btree(btree* t, const char* filename);
 
 //-------------------------------------------------------------------------
 void tree_test_hardcode();
+void tree_test_balanced();
+void tree_test_parallel();
+void tree_test_concurrent();
+void tree_test_scanners();
+void tree_test_hash();
+void tree_test_btree();
+void tree_test_snapshot();
+void tree_test_bulkload();
+void tree_test_lookup();
+void tree_test_stats();
+void tree_test_bounds();
 void tree_test_console_file();
 
 #endif
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "tree.h"
 
 //-------------------------------------------------------------------------
@@ -37,11 +40,49 @@ void tree_test_hardcode() {
   printf("=====================END TESTING=============================\n");
 }
 
+//-------------------------------------------------------------------------
+void tree_test_balanced() {
+  printf("=====================TESTING BALANCED========================\n");
+
+  const char* words[] = {"action", "and", "everyone", "for", "help", "in", "is",
+                         "need", "now", "people", "take", "the", "time", "to"};
+  int n = sizeof(words)/sizeof(words[0]);
+
+  tree* avl = tree_create_mode(TREE_AVL | TREE_ARENA);
+  for (int i = 0; i < n; ++i) {
+    tree_add(avl, words[i]);
+  }
+  tree_add(avl, "the");
+
+  printf("Sorted input of %d words, AVL height %d\n", n, avl->root->height);
+  tree_print_preorder(avl);
+  printf("Level order:\n");
+  tree_print_levelorder(avl);
+  tree_print_levelwidths(avl);
+  printf("Size is %zu\n", tree_size(avl));
+
+  tree_stat st;
+  tree_stats(avl, &st);
+  printf("Height %zu, average depth %.2f, node bytes %zu, word bytes %zu\n",
+         st.height, st.avg_depth, st.node_bytes, st.word_bytes);
+
+  size_t reserved, used;
+  tree_memory(avl, &reserved, &used);
+  printf("Arena bytes reserved %zu, used %zu\n", reserved, used);
+
+  tree_clear(avl);
+  tree_memory(avl, &reserved, &used);
+  printf("After clearing, reserved %zu, used %zu\n", reserved, used);
+  free(avl);
+
+  printf("=====================END TESTING=============================\n");
+}
+
 //-------------------------------------------------------------------------
 void tree_test_console_file(int argc, const char* argv[]) {
   printf("===================TESTING CONSOLE/FILE======================\n");
 
-  tree* t = get_input(argc, argv);
+  tree* t = get_input(argc, argv, 1);
 
   tree_print_inorder(t);
   printf("\nIs my tree empty? %s\n", tree_empty(t) ? "Yes" : "No");
@@ -55,3 +96,594 @@ void tree_test_console_file(int argc, const char* argv[]) {
 
   printf("=====================END TESTING=============================\n");
 }
+
+//-------------------------------------------------------------------------
+//the file-driven tests need exactly one file argument
+static bool tree_test_skip(int argc) {
+  if (argc == 2) { return false; }
+
+  printf("Needs a file argument, skipping\n");
+  printf("=====================END TESTING=============================\n");
+  return true;
+}
+
+//-------------------------------------------------------------------------
+//same words with the same counts, in order; false when b is NULL
+static bool tree_test_same(tree* a, tree* b) {
+  if (b == NULL || tree_size(a) != tree_size(b)) { return false; }
+
+  bool same = true;
+  tree_iter i, j;
+  tnode *p, *q;
+  tree_iter_begin(&i, a, TREE_INORDER);
+  tree_iter_begin(&j, b, TREE_INORDER);
+  while (same && (p = tree_iter_next(&i)) != NULL) {
+    q = tree_iter_next(&j);
+    same = q != NULL && strcmp(p->word, q->word) == 0 && p->count == q->count;
+  }
+  tree_iter_end(&i);
+  tree_iter_end(&j);
+  return same;
+}
+
+//-------------------------------------------------------------------------
+//a tree of pairs that must already be strictly ascending, NULL if not
+static tree* tree_test_from_pairs(tree_pair* pairs, size_t n) {
+  for (size_t i = 1; i < n; ++i) {
+    if (strcmp(pairs[i - 1].word, pairs[i].word) >= 0) { return NULL; }
+  }
+
+  tree* t = tree_create();
+  tree_build_sorted(t, pairs, n);
+  return t;
+}
+
+//-------------------------------------------------------------------------
+void tree_test_parallel(int argc, const char* argv[]) {
+  printf("=====================TESTING PARALLEL========================\n");
+
+  if (tree_test_skip(argc)) { return; }
+
+  tree* serial = tree_create();
+  file_input(serial, argv[1]);
+  tree* parallel = get_input(argc, argv, 4);
+
+  bool same = tree_test_same(serial, parallel);
+
+  printf("Serial size %zu, 4-thread size %zu\n", tree_size(serial), tree_size(parallel));
+  printf("Same words and counts? %s\n", same ? "Yes" : "No");
+
+  tree* shared = tree_create_mode(TREE_CONCURRENT);
+  file_input_parallel(shared, argv[1], 4);
+  bool same_shared = tree_test_same(serial, shared);
+  printf("Same with 4 threads sharing one tree? %s\n", same_shared ? "Yes" : "No");
+  tree_clear(shared);
+  free(shared);
+
+  tree_clear(serial);
+  tree_clear(parallel);
+  free(serial);
+  free(parallel);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+#define TEST_PRODUCERS 8
+#define TEST_ROUNDS 2000
+
+static const char* tree_test_words[] = {"now", "is", "the", "time", "for", "everyone",
+                                        "to", "take", "action", "and", "help", "people"};
+#define TEST_WORDS (sizeof(tree_test_words)/sizeof(tree_test_words[0]))
+
+typedef struct tree_test_shared tree_test_shared;
+struct tree_test_shared {
+  tree* t;
+  int done;
+  bool monotonic;   //no count the reader saw ever went down
+};
+
+//-------------------------------------------------------------------------
+static void* tree_test_producer(void* arg) {
+  tree* t = (tree*)arg;
+  for (int r = 0; r < TEST_ROUNDS; ++r) {
+    for (size_t i = 0; i < TEST_WORDS; ++i) { tree_add(t, tree_test_words[i]); }
+  }
+  return NULL;
+}
+
+//-------------------------------------------------------------------------
+static void* tree_test_reader(void* arg) {
+  tree_test_shared* s = (tree_test_shared*)arg;
+  int last[TEST_WORDS] = {0};
+
+  while (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+    for (size_t i = 0; i < TEST_WORDS; ++i) {
+      int count = tree_count(s->t, tree_test_words[i]);
+      if (count < last[i]) { s->monotonic = false; }
+      last[i] = count;
+    }
+  }
+  return NULL;
+}
+
+//-------------------------------------------------------------------------
+//producers share one TREE_CONCURRENT tree while a reader polls tree_count
+void tree_test_concurrent() {
+  printf("=====================TESTING CONCURRENT======================\n");
+
+  tree_test_shared s = {tree_create_mode(TREE_CONCURRENT), 0, true};
+  pthread_t producers[TEST_PRODUCERS], reader;
+
+  pthread_create(&reader, NULL, tree_test_reader, &s);
+  for (int i = 0; i < TEST_PRODUCERS; ++i) {
+    pthread_create(&producers[i], NULL, tree_test_producer, s.t);
+  }
+  for (int i = 0; i < TEST_PRODUCERS; ++i) { pthread_join(producers[i], NULL); }
+  __atomic_store_n(&s.done, 1, __ATOMIC_RELEASE);
+  pthread_join(reader, NULL);
+
+  bool exact = tree_size(s.t) == TEST_WORDS;
+  for (size_t i = 0; i < TEST_WORDS; ++i) {
+    exact = exact && tree_count(s.t, tree_test_words[i]) == TEST_PRODUCERS * TEST_ROUNDS;
+  }
+  printf("%d producers, size %zu\n", TEST_PRODUCERS, tree_size(s.t));
+  printf("Every count exact? %s\n", exact ? "Yes" : "No");
+  printf("Reader never saw a count go down? %s\n", s.monotonic ? "Yes" : "No");
+
+  tree_clear(s.t);
+  free(s.t);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+//random words and delimiter runs; word lengths up to 40 put token edges
+//on every offset of the 16- and 32-byte blocks the SIMD scanners read
+static size_t tree_test_scanbuf(char* buf, size_t cap, const char* set) {
+  const char* pool = "abcdefgh,. !\n;:|-_()";
+  char letters[32];
+  size_t nletters = 0;
+  for (const char* c = pool; *c != '\0'; ++c) {
+    if (strchr(set, *c) == NULL) { letters[nletters++] = *c; }
+  }
+
+  unsigned state = 12345;
+  size_t n = 0, setlen = strlen(set);
+  while (n + 48 < cap) {
+    state = state * 1103515245 + 12345;
+    size_t run = 1 + (state >> 16) % 40;
+    for (size_t i = 0; i < run; ++i) {
+      state = state * 1103515245 + 12345;
+      buf[n++] = letters[(state >> 16) % nletters];
+    }
+    state = state * 1103515245 + 12345;
+    run = 1 + (state >> 16) % 3;
+    for (size_t i = 0; i < run; ++i) {
+      state = state * 1103515245 + 12345;
+      buf[n++] = set[(state >> 16) % setlen];
+    }
+  }
+  buf[n++] = 'z';   //ends inside a word
+  return n;
+}
+
+//-------------------------------------------------------------------------
+//tokenizes one buffer per delimiter set with every scanner the CPU has
+//and compares each against a byte-at-a-time strchr split
+void tree_test_scanners() {
+  printf("=====================TESTING SCANNERS========================\n");
+
+  const char* sets[] = {",. !\n", ";:|", " ,.;:!?-_()[]{}<>/|\n"};   //the last is over 16
+  const char* names[] = {"default", "custom", "large"};
+  const char* scanners[] = {"scalar", "sse2", "avx2"};
+  char buf[4096];
+
+  for (int k = 0; k < 3; ++k) {
+    size_t n = tree_test_scanbuf(buf, sizeof(buf), sets[k]);
+
+    tree* expect = tree_create_mode(TREE_AVL);
+    for (size_t i = 0; i < n; ) {
+      while (i < n && strchr(sets[k], buf[i]) != NULL) { ++i; }
+      size_t j = i;
+      while (j < n && strchr(sets[k], buf[j]) == NULL) { ++j; }
+      if (j > i) { tree_addn(expect, buf + i, j - i); }
+      i = j;
+    }
+
+    tree_set_delims(sets[k]);
+    printf("%s set, %zu words:", names[k], tree_size(expect));
+    for (int sc = TREE_SCAN_SCALAR; sc <= TREE_SCAN_AVX2; ++sc) {
+      if (!tree_set_scanner(sc)) {
+        printf(" %s n/a", scanners[sc - TREE_SCAN_SCALAR]);
+        continue;
+      }
+      tree* t = tree_create_mode(TREE_AVL);
+      tree_addtokens(t, buf, buf + n);
+      printf(" %s %s", scanners[sc - TREE_SCAN_SCALAR], tree_test_same(expect, t) ? "ok" : "MISMATCH");
+      tree_clear(t);
+      free(t);
+    }
+    printf("\n");
+
+    tree_clear(expect);
+    free(expect);
+  }
+  tree_set_delims(sets[0]);   //back to the default set and scanner
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+void tree_test_hash(int argc, const char* argv[]) {
+  printf("=====================TESTING HASH INGEST=====================\n");
+
+  if (tree_test_skip(argc)) { return; }
+
+  tree* ordered = tree_create_mode(TREE_AVL);
+  file_input_mmap(ordered, argv[1]);
+  tree* hashed = tree_create_mode(TREE_HASH | TREE_ARENA);
+  file_input_mmap(hashed, argv[1]);
+
+  bool same = tree_test_same(ordered, hashed);
+  tree_iter it;
+  tnode* p;
+  tree_iter_begin(&it, hashed, TREE_INORDER);
+  while (same && (p = tree_iter_next(&it)) != NULL) { same = tree_find(hashed, p->word) == p; }
+  tree_iter_end(&it);
+
+  printf("Tree size %zu, hash size %zu\n", tree_size(ordered), tree_size(hashed));
+  printf("Same words and counts? %s\n", same ? "Yes" : "No");
+
+  tree_clear(ordered);
+  tree_clear(hashed);
+  free(ordered);
+  free(hashed);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+void tree_test_btree(int argc, const char* argv[]) {
+  printf("=====================TESTING B-TREE==========================\n");
+
+  if (tree_test_skip(argc)) { return; }
+
+  tree* avl = tree_create_mode(TREE_AVL | TREE_ARENA);
+  file_input_mmap(avl, argv[1]);
+  btree* bt = btree_create();
+  file_input_btree(bt, argv[1]);
+
+  tree_pair* pairs = (tree_pair*)malloc((btree_size(bt) + 1) * sizeof(tree_pair));
+  size_t n = 0;
+  btree_iter b;
+  btree_iter_begin(&b, bt);
+  while (n < btree_size(bt) && btree_iter_next(&b, &pairs[n].word, &pairs[n].count)) { ++n; }
+  tree* copy = n == btree_size(bt) ? tree_test_from_pairs(pairs, n) : NULL;
+
+  bool same = tree_test_same(avl, copy);
+  tree_iter it;
+  tnode* p;
+  tree_iter_begin(&it, avl, TREE_INORDER);
+  while (same && (p = tree_iter_next(&it)) != NULL) { same = btree_count(bt, p->word) == p->count; }
+  tree_iter_end(&it);
+
+  printf("AVL size %zu height %d, B-tree size %zu height %d\n",
+         tree_size(avl), avl->root == NULL ? 0 : avl->root->height, btree_size(bt), bt->height);
+  printf("Same words and counts? %s\n", same ? "Yes" : "No");
+
+  if (copy != NULL) {
+    tree_clear(copy);
+    free(copy);
+  }
+  free(pairs);
+  tree_clear(avl);
+  btree_clear(bt);
+  free(avl);
+  free(bt);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+//copies src to dst with the 8 bytes at pos replaced by value
+static void tree_test_patch(const char* src, const char* dst, size_t pos, uint64_t value) {
+  FILE* in = fopen(src, "rb");
+  FILE* out = fopen(dst, "wb");
+  int c;
+  for (size_t i = 0; (c = fgetc(in)) != EOF; ++i) {
+    fputc(i >= pos && i < pos + sizeof(value) ? (int)((value >> 8 * (i - pos)) & 0xff) : c, out);
+  }
+  fclose(in);
+  fclose(out);
+}
+
+//-------------------------------------------------------------------------
+void tree_test_snapshot(int argc, const char* argv[]) {
+  printf("=====================TESTING SNAPSHOT========================\n");
+
+  if (tree_test_skip(argc)) { return; }
+
+  tree* t = tree_create_mode(TREE_AVL | TREE_ARENA);
+  file_input_mmap(t, argv[1]);
+  tree_save(t, "tree_test.img");
+  tree_image* img = tree_load("tree_test.img");
+
+  size_t n = img == NULL ? 0 : img->size;
+  tree_pair* pairs = (tree_pair*)malloc((n + 1) * sizeof(tree_pair));
+  for (size_t i = 0; i < n; ++i) {
+    pairs[i].word = img->words + img->offset[i];
+    pairs[i].count = img->count[i];
+  }
+  tree* copy = img == NULL ? NULL : tree_test_from_pairs(pairs, n);
+
+  bool same = tree_test_same(t, copy);
+  tree_iter it;
+  tnode* p;
+  tree_iter_begin(&it, t, TREE_INORDER);
+  while (same && (p = tree_iter_next(&it)) != NULL) { same = tree_image_count(img, p->word) == p->count; }
+  tree_iter_end(&it);
+
+  printf("Tree size %zu, image size %zu\n", tree_size(t), img == NULL ? 0 : img->size);
+  printf("Same words and counts? %s\n", same ? "Yes" : "No");
+
+  //a word offset far outside the image must be refused, not followed
+  if (img != NULL && img->size > 1) {
+    size_t pos = (const char*)&img->offset[1] - img->base;
+    tree_test_patch("tree_test.img", "tree_test_bad.img", pos, (uint64_t)1 << 40);
+    tree_image* bad = tree_load("tree_test_bad.img");
+    printf("Corrupt offset rejected? %s\n", bad == NULL ? "Yes" : "No");
+    if (bad != NULL) { tree_image_close(bad); }
+    remove("tree_test_bad.img");
+  }
+
+  if (copy != NULL) {
+    tree_clear(copy);
+    free(copy);
+  }
+  free(pairs);
+  if (img != NULL) { tree_image_close(img); }
+  remove("tree_test.img");
+  tree_clear(t);
+  free(t);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+static const char* tree_test_formats[] = {"plain", "tsv", "debug"};
+
+//writes t with tree_write in format, reads it back with file_input_counts
+//and checks that nothing changed
+static bool tree_test_roundtrip(tree* t, int format) {
+  int fd = open("tree_test_counts.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return false; }
+  tree_writer w;
+  tree_writer_open(&w, fd, format);
+  tree_write(t, TREE_INORDER, &w);
+  tree_writer_close(&w);
+  close(fd);
+
+  tree* back = tree_create();
+  file_input_counts(back, "tree_test_counts.txt");
+  bool same = tree_test_same(t, back);
+  remove("tree_test_counts.txt");
+  tree_clear(back);
+  free(back);
+  return same;
+}
+
+//-------------------------------------------------------------------------
+void tree_test_bulkload() {
+  printf("=====================TESTING BULK LOAD=======================\n");
+
+  tree_pair pairs[] = {{"action", 2}, {"and", 1}, {"everyone", 1}, {"for", 3},
+                       {"help", 1}, {"in", 1}, {"is", 2}, {"need", 1},
+                       {"now", 1}, {"people", 1}, {"take", 1}, {"the", 4},
+                       {"time", 1}, {"to", 1}, {"and", 1}};
+  size_t n = sizeof(pairs)/sizeof(pairs[0]);
+
+  tree* t = tree_create();
+  tree_build_sorted(t, pairs, n - 1);
+  tree_print_levelwidths(t);
+
+  tree_build_sorted(t, pairs + n - 1, 1);
+  tree_build_sorted(t, pairs, 2);
+  tree_print_inorder(t);
+  printf("Size is %zu\n", tree_size(t));
+
+  for (int format = TREE_FMT_PLAIN; format <= TREE_FMT_DEBUG; ++format) {
+    printf("Reloaded from %s output? %s\n", tree_test_formats[format],
+           tree_test_roundtrip(t, format) ? "Yes" : "No");
+  }
+
+  tree_clear(t);
+  free(t);
+
+  //enough words that every format fills the 1 MB writer buffer and flushes
+  size_t big = 150000;
+  char* storage = (char*)malloc(big * 8);
+  tree_pair* many = (tree_pair*)malloc(big * sizeof(tree_pair));
+  for (size_t i = 0; i < big; ++i) {
+    snprintf(storage + i * 8, 8, "w%06zu", i);
+    many[i].word = storage + i * 8;
+    many[i].count = (int)(i % 97) + 1;
+  }
+  t = tree_create();
+  tree_build_sorted(t, many, big);
+  bool reloaded = true;
+  for (int format = TREE_FMT_PLAIN; format <= TREE_FMT_DEBUG; ++format) {
+    reloaded = reloaded && tree_test_roundtrip(t, format);
+  }
+  printf("Reloaded %zu words, past the writer buffer, in every format? %s\n",
+         tree_size(t), reloaded ? "Yes" : "No");
+
+  tree_clear(t);
+  free(t);
+  free(many);
+  free(storage);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+void tree_test_lookup() {
+  printf("=====================TESTING LOOKUP==========================\n");
+
+  tree* t = tree_create_mode(TREE_AVL);
+  const char* words[] = {"now", "is", "the", "time", "for", "everyone", "to",
+                         "take", "action", "and", "help", "the", "people"};
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); ++i) {
+    tree_add(t, words[i]);
+  }
+
+  printf("Count of the: %d, of missing: %d\n", tree_count(t, "the"), tree_count(t, "missing"));
+
+  const char* queries[] = {"time", "zebra", "and", "the", "aardvark", "time", "people"};
+  size_t n = sizeof(queries)/sizeof(queries[0]);
+  tnode* found[sizeof(queries)/sizeof(queries[0])];
+  tree_find_many(t, queries, n, found);
+  for (size_t i = 0; i < n; ++i) {
+    printf("%s: %s\n", queries[i], found[i] == tree_find(t, queries[i]) ? "ok" : "MISMATCH");
+  }
+
+  tree_clear(t);
+  free(t);
+
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+#ifdef TREE_STATS
+static bool tree_test_ops(tree* t, uint64_t adds, uint64_t finds, uint64_t compares) {
+  return t->ops.adds == adds && t->ops.finds == finds && t->ops.compares == compares;
+}
+#endif
+
+//-------------------------------------------------------------------------
+//counters on a known input: every mode that walks the plain BST must count
+//the same adds, finds and compares. Needs tree.c and this file built with
+//-DTREE_STATS.
+void tree_test_stats() {
+  printf("=====================TESTING STATS===========================\n");
+#ifdef TREE_STATS
+  const char* words[] = {"m", "c", "t", "c", "a"};
+  const char* queries[] = {"c", "z", "a"};
+  tnode* found[3];
+  int modes[] = {TREE_PLAIN, TREE_CONCURRENT};
+
+  for (size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m) {
+    tree* t = tree_create_mode(modes[m]);
+    for (size_t i = 0; i < 5; ++i) { tree_add(t, words[i]); }
+    bool adds = tree_test_ops(t, 5, 0, 6);      //0 + 1 + 1 + 2 + 2 compares
+    tree_find(t, "c");
+    tree_find(t, "z");
+    bool finds = tree_test_ops(t, 5, 2, 10);    //2 + 2 compares
+    tree_find_many(t, queries, 3, found);
+    bool many = tree_test_ops(t, 5, 5, 20);     //3 at m, 2 at t, 3 at c, 2 at a
+    printf("mode %d adds %s, finds %s, find_many %s\n", modes[m],
+           adds ? "exact" : "MISMATCH", finds ? "exact" : "MISMATCH", many ? "exact" : "MISMATCH");
+    tree_clear(t);
+    free(t);
+  }
+
+  tree* t = tree_create_mode(TREE_CONCURRENT);
+  pthread_t producers[TEST_PRODUCERS];
+  for (int i = 0; i < TEST_PRODUCERS; ++i) {
+    pthread_create(&producers[i], NULL, tree_test_producer, t);
+  }
+  for (int i = 0; i < TEST_PRODUCERS; ++i) { pthread_join(producers[i], NULL); }
+  bool shared = t->ops.adds == (uint64_t)TEST_PRODUCERS * TEST_ROUNDS * TEST_WORDS;
+  printf("Concurrent adds counted %s\n", shared ? "exact" : "MISMATCH");
+  tree_clear(t);
+  free(t);
+#else
+  printf("skipped, build with -DTREE_STATS\n");
+#endif
+  printf("=====================END TESTING=============================\n");
+}
+
+//-------------------------------------------------------------------------
+static void tree_test_collect(tnode* p, void* arg) {
+  size_t* n = (size_t*)arg;
+  ++*n;
+  (void)p;
+}
+
+//-------------------------------------------------------------------------
+//bounds and prefix ranges against a plain in-order scan
+void tree_test_bounds() {
+  printf("=====================TESTING BOUNDS==========================\n");
+
+  tree* t = tree_create_mode(TREE_AVL);
+  const char* words[] = {"now", "is", "the", "time", "for", "everyone", "to",
+                         "take", "action", "and", "help", "the", "people"};
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); ++i) {
+    tree_add(t, words[i]);
+  }
+
+  const char* keys[] = {"", "and", "bz", "the", "to", "zz"};
+  for (size_t i = 0; i < sizeof(keys)/sizeof(keys[0]); ++i) {
+    tnode* lower = NULL;
+    tnode* upper = NULL;
+    tnode* p;
+    tree_iter it;
+    tree_iter_begin(&it, t, TREE_INORDER);
+    while ((p = tree_iter_next(&it)) != NULL) {
+      if (lower == NULL && strcmp(p->word, keys[i]) >= 0) { lower = p; }
+      if (upper == NULL && strcmp(p->word, keys[i]) > 0) { upper = p; }
+    }
+    tree_iter_end(&it);
+
+    printf("bounds of \"%s\": %s, %s  %s\n", keys[i],
+           lower == NULL ? "(end)" : lower->word, upper == NULL ? "(end)" : upper->word,
+           lower == tree_lower_bound(t, keys[i]) && upper == tree_upper_bound(t, keys[i])
+           ? "ok" : "MISMATCH");
+  }
+
+  //a missing key, one before the first word, one after the last, and only
+  //the first 3 bytes of "thermos"
+  const char* seeks[] = {"bz", "aardvark", "zz", "thermos"};
+  size_t lens[] = {2, 8, 2, 3};
+  const char* expect[] = {"everyone", "action", NULL, "the"};
+  for (size_t i = 0; i < sizeof(seeks)/sizeof(seeks[0]); ++i) {
+    tree_iter it;
+    tree_iter_begin(&it, t, TREE_INORDER);
+    tree_iter_seek(&it, seeks[i], lens[i]);
+    tnode* p = tree_iter_next(&it);
+    tnode* q = p == NULL ? NULL : tree_iter_next(&it);
+    tree_iter_end(&it);
+
+    bool ok = expect[i] == NULL ? p == NULL : p != NULL && strcmp(p->word, expect[i]) == 0 &&
+                                              q == tree_upper_bound(t, p->word);
+    printf("seek \"%.*s\": %s  %s\n", (int)lens[i], seeks[i], p == NULL ? "(end)" : p->word,
+           ok ? "ok" : "MISMATCH");
+  }
+
+  //everything, nothing, and a range that runs to the end of the tree
+  const char* prefixes[] = {"", "q", "t", "to"};
+  for (size_t i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]); ++i) {
+    size_t n = strlen(prefixes[i]);
+    size_t matches = 0, visited = 0;
+    tnode* next = NULL;
+    tnode* p;
+    tree_iter it;
+    tree_iter_begin(&it, t, TREE_INORDER);
+    while ((p = tree_iter_next(&it)) != NULL) {
+      int compare = strncmp(p->word, prefixes[i], n);
+      if (compare == 0) { ++matches; }
+      if (next == NULL && compare > 0) { next = p; }
+    }
+    tree_iter_end(&it);
+
+    tnode* after = tree_prefix_range(t, prefixes[i], n, tree_test_collect, &visited);
+    printf("prefix \"%s\": %zu words, then %s  %s\n", prefixes[i], visited,
+           after == NULL ? "(end)" : after->word,
+           visited == matches && after == next ? "ok" : "MISMATCH");
+  }
+
+  tree_clear(t);
+  free(t);
+
+  printf("=====================END TESTING=============================\n");
+}